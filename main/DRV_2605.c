@@ -1,30 +1,336 @@
 
 #include "DRV_2605.h"
+#include "DRV_2605_trace.h"
+#include "DRV_2605_capture.h"
 #include "esp_log.h"
 #include "driver/i2c.h"
 #include "esp_err.h"
 #include "esp_check.h"
 #include "math.h"
+#include "string.h"
+#include "stdlib.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
 
 const char* TAG = "DRV_2605";
 
+// Registers which are changed by the device itself and therefore can not be shadowed
+#define DRV2605_VOLATILE_REGS ( \
+    (1ULL << DRV2605_REG_STATUS) | \
+    (1ULL << DRV2605_REG_GO) | \
+    (1ULL << DRV2605_REG_VBAT) | \
+    (1ULL << DRV2605_REG_LRARESON))
+
+// Registers the device writes its calibration results to. They can only be
+// shadowed while no calibration is running.
+#define DRV2605_CALIBRATION_REGS ( \
+    (1ULL << DRV2605_REG_AUTOCALCOMP) | \
+    (1ULL << DRV2605_REG_AUTOCALEMP) | \
+    (1ULL << DRV2605_REG_FEEDBACK))
+
+// Last known content of the device registers, one set per I2C port
+typedef struct {
+    uint8_t value[DRV2605_REG_COUNT];
+    uint64_t valid;
+} reg_shadow_t;
+
+// Guards the shadow, the statistics and the resync state of all ports. The
+// async transport task and the tasks using the blocking API share them.
+static portMUX_TYPE driver_lock = portMUX_INITIALIZER_UNLOCKED;
+static reg_shadow_t reg_shadow[I2C_NUM_MAX];
+static bool calibration_running[I2C_NUM_MAX];
+
+void i2c_shadow_update(uint8_t ic2_port, uint8_t reg, uint8_t value) {
+    if(ic2_port >= I2C_NUM_MAX || reg >= DRV2605_REG_COUNT || ((DRV2605_VOLATILE_REGS >> reg) & 0x01)) {
+        return;
+    }
+    portENTER_CRITICAL(&driver_lock);
+    if(!calibration_running[ic2_port] || !((DRV2605_CALIBRATION_REGS >> reg) & 0x01)) {
+        reg_shadow[ic2_port].value[reg] = value;
+        reg_shadow[ic2_port].valid |= 1ULL << reg;
+    }
+    portEXIT_CRITICAL(&driver_lock);
+}
+
+void i2c_shadow_update_seq(uint8_t ic2_port, uint8_t reg, const uint8_t* data, size_t length) {
+    for(size_t i = 0; i < length; i++) {
+        i2c_shadow_update(ic2_port, reg + i, data[i]);
+    }
+}
+
+static bool i2c_shadow_get(uint8_t ic2_port, uint8_t reg, uint8_t* value) {
+    if(ic2_port >= I2C_NUM_MAX || reg >= DRV2605_REG_COUNT) {
+        return false;
+    }
+    portENTER_CRITICAL(&driver_lock);
+    bool valid = (reg_shadow[ic2_port].valid >> reg) & 0x01;
+    *value = reg_shadow[ic2_port].value[reg];
+    portEXIT_CRITICAL(&driver_lock);
+    return valid;
+}
+
+static void i2c_shadow_invalidate(uint8_t ic2_port) {
+    if(ic2_port < I2C_NUM_MAX) {
+        portENTER_CRITICAL(&driver_lock);
+        reg_shadow[ic2_port].valid = 0;
+        portEXIT_CRITICAL(&driver_lock);
+    }
+}
+
+// Pins of the bus, needed to clock a stuck slave free
+typedef struct {
+    gpio_num_t sda;
+    gpio_num_t scl;
+    bool pullup;
+    bool configured;
+} bus_recovery_t;
+
+static bus_recovery_t bus_recovery[I2C_NUM_MAX];
+static DRV2605_error_stats_t error_stats[I2C_NUM_MAX];
+static DRV2605_sequence_cache_stats_t sequence_cache_stats[I2C_NUM_MAX];
+// Non zero while the driver restores the registers of a reset device or
+// resets it, so the transfers issued for that do not start another resync
+static uint8_t resync_in_progress[I2C_NUM_MAX];
+
+// Returns true if no other resync or reset was running on the port
+static bool resync_enter(uint8_t ic2_port) {
+    portENTER_CRITICAL(&driver_lock);
+    bool first = resync_in_progress[ic2_port]++ == 0;
+    portEXIT_CRITICAL(&driver_lock);
+    return first;
+}
+
+static void resync_leave(uint8_t ic2_port) {
+    portENTER_CRITICAL(&driver_lock);
+    resync_in_progress[ic2_port]--;
+    portEXIT_CRITICAL(&driver_lock);
+}
+// Time by which every transaction on the port has to be done, 0 if there is
+// none. Set during haptic_cold_start, it caps the bus timeout and the retries.
+static int64_t transfer_deadline[I2C_NUM_MAX];
+
+#ifdef DRV2605_FAULT_INJECTION
+typedef struct {
+    DRV2605_fault_t fault;
+    uint8_t count;
+} fault_injection_t;
+
+static fault_injection_t fault_injection[I2C_NUM_MAX];
+
+static esp_err_t i2c_injected_fault(uint8_t ic2_port) {
+    fault_injection_t* injection = &fault_injection[ic2_port];
+    if(injection->count == 0) {
+        return ESP_OK;
+    }
+    switch(injection->fault) {
+        case DRV2605_FAULT_NACK:
+            injection->count--;
+            return ESP_FAIL;
+        case DRV2605_FAULT_STUCK_BUS:
+            // cleared by i2c_bus_recover
+            return ESP_ERR_TIMEOUT;
+        case DRV2605_FAULT_DEVICE_RESET: {
+            // really reset the device behind the back of the driver, it
+            // does not acknowledge the transaction which was interrupted
+            injection->count = 0;
+            uint8_t buffer[2] = {DRV2605_REG_MODE, DRV2605_MASK_MODE_RESET};
+            i2c_master_write_to_device(ic2_port, DRV_2650_WRITE_ADDRESS, buffer, 2, DRV_2650_TIMEOUT);
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+void haptic_inject_fault(uint8_t ic2_port, DRV2605_fault_t fault, uint8_t count) {
+    if(ic2_port < I2C_NUM_MAX) {
+        fault_injection[ic2_port].fault = fault;
+        fault_injection[ic2_port].count = count;
+    }
+}
+#endif
+
+esp_err_t haptic_configure_bus_recovery(uint8_t ic2_port, gpio_num_t sda, gpio_num_t scl, bool pullup) {
+    ESP_RETURN_ON_FALSE(ic2_port < I2C_NUM_MAX, ESP_ERR_INVALID_ARG, TAG, "Invalid I2C port %d", ic2_port);
+    bus_recovery[ic2_port] = (bus_recovery_t) {
+        .sda = sda,
+        .scl = scl,
+        .pullup = pullup,
+        .configured = true,
+    };
+    return ESP_OK;
+}
+
+// Clocks SCL until a slave holding SDA low has shifted out its byte, then
+// generates a STOP and hands the pins back to the I2C controller.
+static esp_err_t i2c_bus_recover(uint8_t ic2_port) {
+    bus_recovery_t* bus = &bus_recovery[ic2_port];
+    if(!bus->configured) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    portENTER_CRITICAL(&driver_lock);
+    error_stats[ic2_port].bus_recoveries++;
+    portEXIT_CRITICAL(&driver_lock);
+#ifdef DRV2605_FAULT_INJECTION
+    if(fault_injection[ic2_port].fault == DRV2605_FAULT_STUCK_BUS) {
+        fault_injection[ic2_port].count = 0;
+    }
+#endif
+    gpio_set_level(bus->sda, 1);
+    gpio_set_level(bus->scl, 1);
+    gpio_set_direction(bus->sda, GPIO_MODE_INPUT_OUTPUT_OD);
+    gpio_set_direction(bus->scl, GPIO_MODE_INPUT_OUTPUT_OD);
+    for(uint8_t i = 0; i < DRV2605_BUS_RECOVERY_CLOCKS && gpio_get_level(bus->sda) == 0; i++) {
+        gpio_set_level(bus->scl, 0);
+        esp_rom_delay_us(DRV2605_BUS_RECOVERY_HALF_PERIOD_US);
+        gpio_set_level(bus->scl, 1);
+        esp_rom_delay_us(DRV2605_BUS_RECOVERY_HALF_PERIOD_US);
+    }
+    // STOP condition: SDA rises while SCL is high
+    gpio_set_level(bus->scl, 0);
+    gpio_set_level(bus->sda, 0);
+    esp_rom_delay_us(DRV2605_BUS_RECOVERY_HALF_PERIOD_US);
+    gpio_set_level(bus->scl, 1);
+    esp_rom_delay_us(DRV2605_BUS_RECOVERY_HALF_PERIOD_US);
+    gpio_set_level(bus->sda, 1);
+    esp_rom_delay_us(DRV2605_BUS_RECOVERY_HALF_PERIOD_US);
+    bool released = gpio_get_level(bus->sda) != 0;
+    ESP_RETURN_ON_ERROR(i2c_set_pin(ic2_port, bus->sda, bus->scl, bus->pullup, bus->pullup, I2C_MODE_MASTER), TAG, "Could not reattach pins to I2C port %d", ic2_port);
+    return released ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t i2c_transfer_once(uint8_t ic2_port, const uint8_t* write, size_t write_length, uint8_t* read, size_t read_length) {
+    TickType_t ticks_to_wait = DRV_2650_TIMEOUT;
+    if(transfer_deadline[ic2_port] != 0) {
+        int64_t remaining_us = transfer_deadline[ic2_port] - esp_timer_get_time();
+        if(remaining_us <= 0) {
+            return ESP_ERR_TIMEOUT;
+        }
+        TickType_t remaining = pdMS_TO_TICKS((remaining_us + 999) / 1000);
+        ticks_to_wait = remaining == 0 ? 1 : (remaining < ticks_to_wait ? remaining : ticks_to_wait);
+    }
+#if DRV2605_CAPTURE_ENABLED
+    int64_t start = haptic_capture_active() ? esp_timer_get_time() : 0;
+    // the read may land in the same buffer as the register address
+    uint8_t reg = write[0];
+#endif
+    esp_err_t result;
+#ifdef DRV2605_FAULT_INJECTION
+    result = i2c_injected_fault(ic2_port);
+    if(result != ESP_OK) {
+        DRV2605_CAPTURE(ic2_port, read_length ? DRV2605_CAPTURE_FLAG_READ : 0, reg, NULL, 0, result, start, start);
+        return result;
+    }
+#endif
+    if(read_length == 0) {
+        result = i2c_master_write_to_device(ic2_port, DRV_2650_WRITE_ADDRESS, write, write_length, ticks_to_wait);
+        DRV2605_CAPTURE(ic2_port, 0, reg, &write[1], write_length - 1, result, start, esp_timer_get_time());
+    } else {
+        result = i2c_master_write_read_device(ic2_port, DRV_2650_WRITE_ADDRESS, write, write_length, read, read_length, ticks_to_wait);
+        DRV2605_CAPTURE(ic2_port, DRV2605_CAPTURE_FLAG_READ, reg, read, result == ESP_OK ? read_length : 0, result, start, esp_timer_get_time());
+    }
+    return result;
+}
+
+// Runs one transaction with a bounded number of retries. A NACK is retried
+// after an exponentially growing pause, a timeout indicates a stuck bus and
+// triggers a bus recovery first. Before the transaction is repeated the device
+// is checked for a reset, so the restored registers can not overwrite what the
+// repeated transaction writes, and a repeated read sees the restored content.
+static esp_err_t i2c_transfer(uint8_t ic2_port, const uint8_t* write, size_t write_length, uint8_t* read, size_t read_length) {
+    if(ic2_port >= I2C_NUM_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&driver_lock);
+    error_stats[ic2_port].transfers++;
+    portEXIT_CRITICAL(&driver_lock);
+    esp_err_t result = i2c_transfer_once(ic2_port, write, write_length, read, read_length);
+    if(result == ESP_OK || (result != ESP_FAIL && result != ESP_ERR_TIMEOUT)) {
+        return result;
+    }
+
+    int64_t start = esp_timer_get_time();
+    uint32_t backoff_us = DRV2605_RETRY_BACKOFF_US;
+    uint32_t retries = 0;
+    // a resync already running on the port makes haptic_try_resync return at once
+    bool resynced = false;
+    for(uint8_t retry = 0; retry < DRV2605_MAX_RETRIES && (result == ESP_FAIL || result == ESP_ERR_TIMEOUT); retry++) {
+        if(transfer_deadline[ic2_port] != 0 && esp_timer_get_time() + backoff_us > transfer_deadline[ic2_port]) {
+            break;
+        }
+        if(result == ESP_ERR_TIMEOUT) {
+            i2c_bus_recover(ic2_port);
+        }
+        esp_rom_delay_us(backoff_us);
+        backoff_us *= 2;
+        if(!resynced) {
+            // only counts once the device answered the check
+            resynced = haptic_try_resync(ic2_port) == ESP_OK;
+        }
+        retries++;
+        result = i2c_transfer_once(ic2_port, write, write_length, read, read_length);
+    }
+    int64_t duration = esp_timer_get_time() - start;
+    portENTER_CRITICAL(&driver_lock);
+    DRV2605_error_stats_t* stats = &error_stats[ic2_port];
+    stats->retries += retries;
+    stats->retry_time_us += duration;
+    if(result != ESP_OK) {
+        stats->failures++;
+    } else {
+        stats->last_recovery_us = duration;
+    }
+    portEXIT_CRITICAL(&driver_lock);
+    return result;
+}
+
+void haptic_get_error_stats(uint8_t ic2_port, DRV2605_error_stats_t* stats) {
+    if(ic2_port < I2C_NUM_MAX) {
+        portENTER_CRITICAL(&driver_lock);
+        *stats = error_stats[ic2_port];
+        portEXIT_CRITICAL(&driver_lock);
+    }
+}
+
 esp_err_t i2c_write_reg(uint8_t ic2_port, uint8_t reg, uint8_t value) {
     uint8_t buffer[2] = {reg, value};
-    ESP_RETURN_ON_ERROR(i2c_master_write_to_device(ic2_port, DRV_2650_WRITE_ADDRESS, buffer, 2, DRV_2650_TIMEOUT), TAG, "Could not write value %d to register %d", value, reg);
+    esp_err_t result = i2c_transfer(ic2_port, buffer, 2, NULL, 0);
+    DRV2605_TRACE(DRV2605_TRACE_OP_WRITE, ic2_port, reg, value, result);
+    ESP_RETURN_ON_ERROR(result, TAG, "Could not write value %d to register %d", value, reg);
+    i2c_shadow_update(ic2_port, reg, value);
     return ESP_OK;
 }
 
 esp_err_t i2c_write_reg_seq(uint8_t ic2_port, uint8_t reg, uint8_t* value, size_t length) {
-    uint8_t buffer[1] = {reg};
-    ESP_RETURN_ON_ERROR(i2c_master_write_to_device(ic2_port, DRV_2650_WRITE_ADDRESS, buffer, 1, DRV_2650_TIMEOUT), TAG, "Could not initiate write to register %d", reg);
-    ESP_RETURN_ON_ERROR(i2c_master_write_to_device(ic2_port, DRV_2650_WRITE_ADDRESS, value, length, DRV_2650_TIMEOUT), TAG, "Could not write data sequence to register %d", reg);
+    // The register address and the data have to go out in the same transaction,
+    // otherwise the device treats the data as a new register address
+    uint8_t buffer[1 + DRV2605_REG_COUNT];
+    ESP_RETURN_ON_FALSE(length <= DRV2605_REG_COUNT, ESP_ERR_INVALID_SIZE, TAG, "Sequence of %u bytes is too long", (unsigned)length);
+    buffer[0] = reg;
+    memcpy(&buffer[1], value, length);
+    esp_err_t result = i2c_transfer(ic2_port, buffer, length + 1, NULL, 0);
+    DRV2605_TRACE(DRV2605_TRACE_OP_WRITE_SEQ, ic2_port, reg, length, result);
+    ESP_RETURN_ON_ERROR(result, TAG, "Could not write data sequence to register %d", reg);
+    i2c_shadow_update_seq(ic2_port, reg, value, length);
     return ESP_OK;
 }
 
 esp_err_t i2c_read_reg(uint8_t ic2_port, uint8_t reg, uint8_t* data) {
     uint8_t buffer[1] = {reg};
-    ESP_RETURN_ON_ERROR(i2c_master_write_read_device(ic2_port, DRV_2650_WRITE_ADDRESS, buffer, 1, buffer, 1, DRV_2650_TIMEOUT), TAG, "Could not read data from register %d", reg);
+    esp_err_t result = i2c_transfer(ic2_port, buffer, 1, buffer, 1);
+    DRV2605_TRACE(DRV2605_TRACE_OP_READ, ic2_port, reg, buffer[0], result);
+    ESP_RETURN_ON_ERROR(result, TAG, "Could not read data from register %d", reg);
     *data = buffer[0];
+    i2c_shadow_update(ic2_port, reg, buffer[0]);
+    return ESP_OK;
+}
+
+esp_err_t i2c_read_reg_seq(uint8_t ic2_port, uint8_t reg, uint8_t* data, size_t length) {
+    uint8_t buffer[1] = {reg};
+    esp_err_t result = i2c_transfer(ic2_port, buffer, 1, data, length);
+    DRV2605_TRACE(DRV2605_TRACE_OP_READ_SEQ, ic2_port, reg, length, result);
+    ESP_RETURN_ON_ERROR(result, TAG, "Could not read data sequence from register %d", reg);
+    i2c_shadow_update_seq(ic2_port, reg, data, length);
     return ESP_OK;
 }
 
@@ -35,7 +341,23 @@ esp_err_t i2c_modify_reg(uint8_t ic2_port, uint8_t reg, uint8_t value, uint8_t m
     temp |= value & mask;
     ESP_RETURN_ON_ERROR(i2c_write_reg(ic2_port, reg, temp), TAG, "Could not modify value in register %d", reg);
     ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, reg, &temp), TAG, "Could not read value from register %d", reg);
-    ESP_LOGI(TAG, "REG %x == %x", reg, temp);
+    DRV2605_TRACE(DRV2605_TRACE_OP_MODIFY, ic2_port, reg, temp, ESP_OK);
+    return ESP_OK;
+}
+
+// Like i2c_modify_reg but takes the current register content from the shadow
+// when it is known and skips the write entirely if nothing would change
+esp_err_t i2c_modify_reg_shadowed(uint8_t ic2_port, uint8_t reg, uint8_t value, uint8_t mask) {
+    uint8_t current;
+    if(!i2c_shadow_get(ic2_port, reg, &current)) {
+        ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, reg, &current), TAG, "Could not read value from register %d", reg);
+    }
+    uint8_t temp = (current & ~mask) | (value & mask);
+    if(temp == current) {
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_ERROR(i2c_write_reg(ic2_port, reg, temp), TAG, "Could not modify value in register %d", reg);
+    DRV2605_TRACE(DRV2605_TRACE_OP_MODIFY, ic2_port, reg, temp, ESP_OK);
     return ESP_OK;
 }
 
@@ -80,164 +402,341 @@ void debug_set_reg_descriptions(char* desc[8], char* desc0, char* desc1, char* d
     desc[7] = desc7;
 }
 
-void haptic_register_dump(uint8_t ic2_port) {
+esp_err_t haptic_try_register_dump(uint8_t ic2_port) {
     ESP_LOGI(TAG, "Start of DRV2605 Register dump:");
     uint8_t data;
     char* descriptions[8] = {"DEVICE_ID[2]", "DEVICE_ID[1]", "DEVICE_ID[0]", NULL, "DIAG_RESULT", NULL, "OVER_TEMP", "OC_DETECT"};
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_STATUS, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_STATUS, &data), TAG, "Register dump failed");
     debug_print_reg("Status", DRV2605_REG_STATUS, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "DEV_RESET", "STANDBY", NULL, NULL, NULL, "MODE[2]", "MODE[1]", "MODE[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_MODE, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_MODE, &data), TAG, "Register dump failed");
     debug_print_reg("Mode", DRV2605_REG_MODE, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "RTP_INPUT[7]", "RTP_INPUT[6]", "RTP_INPUT[5]", "RTP_INPUT[4]", "RTP_INPUT[3]", "RTP_INPUT[2]", "RTP_INPUT[1]", "RTP_INPUT[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_RTPIN, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_RTPIN, &data), TAG, "Register dump failed");
     debug_print_reg("Real Time Playback Input", DRV2605_REG_RTPIN, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, NULL, NULL, NULL, "HI_Z", NULL, "LIBRARY_SEL[2]", "LIBRARY_SEL[1]", "LIBRARY_SEL[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_LIBRARY, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_LIBRARY, &data), TAG, "Register dump failed");
     debug_print_reg("Library Select", DRV2605_REG_LIBRARY, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "WAIT", "WAV_FRM_SEQ[6]", "WAV_FRM_SEQ[5]", "WAV_FRM_SEQ[4]", "WAV_FRM_SEQ[3]", "WAV_FRM_SEQ[2]", "WAV_FRM_SEQ[1]", "WAV_FRM_SEQ[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ1, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ1, &data), TAG, "Register dump failed");
     debug_print_reg("Waveform Sequencer", DRV2605_REG_WAVESEQ1, descriptions, data, false);
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ2, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ2, &data), TAG, "Register dump failed");
     debug_print_reg("Waveform Sequencer", DRV2605_REG_WAVESEQ2, descriptions, data, false);
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ3, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ3, &data), TAG, "Register dump failed");
     debug_print_reg("Waveform Sequencer", DRV2605_REG_WAVESEQ3, descriptions, data, false);
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ4, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ4, &data), TAG, "Register dump failed");
     debug_print_reg("Waveform Sequencer", DRV2605_REG_WAVESEQ4, descriptions, data, false);
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ5, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ5, &data), TAG, "Register dump failed");
     debug_print_reg("Waveform Sequencer", DRV2605_REG_WAVESEQ5, descriptions, data, false);
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ6, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ6, &data), TAG, "Register dump failed");
     debug_print_reg("Waveform Sequencer", DRV2605_REG_WAVESEQ6, descriptions, data, false);
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ7, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ7, &data), TAG, "Register dump failed");
     debug_print_reg("Waveform Sequencer", DRV2605_REG_WAVESEQ7, descriptions, data, false);
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ8, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_WAVESEQ8, &data), TAG, "Register dump failed");
     debug_print_reg("Waveform Sequencer", DRV2605_REG_WAVESEQ8, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, NULL, NULL, NULL, NULL, NULL, NULL, NULL, "GO");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_GO, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_GO, &data), TAG, "Register dump failed");
     debug_print_reg("Mode", DRV2605_REG_GO, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "ODT[7]", "ODT[6]", "ODT[5]", "ODT[4]", "ODT[3]", "ODT[2]", "ODT[1]", "ODT[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_OVERDRIVE, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_OVERDRIVE, &data), TAG, "Register dump failed");
     debug_print_reg("Overdrive Time Offset", DRV2605_REG_OVERDRIVE, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "SPT[7]", "SPT[6]", "SPT[5]", "SPT[4]", "SPT[3]", "SPT[2]", "SPT[1]", "SPT[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_SUSTAINPOS, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_SUSTAINPOS, &data), TAG, "Register dump failed");
     debug_print_reg("Sustain Time Pos. Offset", DRV2605_REG_SUSTAINPOS, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "SNT[7]", "SNT[6]", "SNT[5]", "SNT[4]", "SNT[3]", "SNT[2]", "SNT[1]", "SNT[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_SUSTAINNEG, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_SUSTAINNEG, &data), TAG, "Register dump failed");
     debug_print_reg("Sustain Time Neg. Offset", DRV2605_REG_SUSTAINNEG, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "BRT[7]", "BRT[6]", "BRT[5]", "BRT[4]", "BRT[3]", "BRT[2]", "BRT[1]", "BRT[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_BREAK, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_BREAK, &data), TAG, "Register dump failed");
     debug_print_reg("Break Time Offset", DRV2605_REG_BREAK, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, NULL, NULL, NULL, NULL, "PEAK_TIME[1]", "PEAK_TIME[0]", "FILTER[1]", "FILTER[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_AUDIOCTRL, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_AUDIOCTRL, &data), TAG, "Register dump failed");
     debug_print_reg("Audio-to-Vibe(A2V) Contr.", DRV2605_REG_AUDIOCTRL, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "MIN_INPUT[7]", "MIN_INPUT[6]", "MIN_INPUT[5]", "MIN_INPUT[4]", "MIN_INPUT[3]", "MIN_INPUT[2]", "MIN_INPUT[1]", "MIN_INPUT[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_AUDIOLVL, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_AUDIOLVL, &data), TAG, "Register dump failed");
     debug_print_reg("A2V Minimum Input Level", DRV2605_REG_AUDIOLVL, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "MAX_INPUT[7]", "MAX_INPUT[6]", "MAX_INPUT[5]", "MAX_INPUT[4]", "MAX_INPUT[3]", "MAX_INPUT[2]", "MAX_INPUT[1]", "MAX_INPUT[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_AUDIOMAX, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_AUDIOMAX, &data), TAG, "Register dump failed");
     debug_print_reg("A2V Maximum Input Level", DRV2605_REG_AUDIOMAX, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "MIN_DRIVE[7]", "MIN_DRIVE[6]", "MIN_DRIVE[5]", "MIN_DRIVE[4]", "MIN_DRIVE[3]", "MIN_DRIVE[2]", "MIN_DRIVE[1]", "MIN_DRIVE[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_AUDIOOUTMIN, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_AUDIOOUTMIN, &data), TAG, "Register dump failed");
     debug_print_reg("A2V Minimum Output Drive", DRV2605_REG_AUDIOOUTMIN, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "MAX_DRIVE[7]", "MAX_DRIVE[6]", "MAX_DRIVE[5]", "MAX_DRIVE[4]", "MAX_DRIVE[3]", "MAX_DRIVE[2]", "MAX_DRIVE[1]", "MAX_DRIVE[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_AUDIOOUTMAX, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_AUDIOOUTMAX, &data), TAG, "Register dump failed");
     debug_print_reg("A2V Maximum Output Drive", DRV2605_REG_AUDIOOUTMAX, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "RATED_VOLTAGE[7]", "RATED_VOLTAGE[6]", "RATED_VOLTAGE[5]", "RATED_VOLTAGE[4]", "RATED_VOLTAGE[3]", "RATED_VOLTAGE[2]", "RATED_VOLTAGE[1]", "RATED_VOLTAGE[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_RATEDV, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_RATEDV, &data), TAG, "Register dump failed");
     debug_print_reg("Rated Voltage", DRV2605_REG_RATEDV, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "OD_CLAMP[7]", "OD_CLAMP[6]", "OD_CLAMP[5]", "OD_CLAMP[4]", "OD_CLAMP[3]", "OD_CLAMP[2]", "OD_CLAMP[1]", "OD_CLAMP[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_CLAMPV, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_CLAMPV, &data), TAG, "Register dump failed");
     debug_print_reg("Overdrive Clamp Voltage", DRV2605_REG_CLAMPV, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "A_CAL_COMP[7]", "A_CAL_COMP[6]", "A_CAL_COMP[5]", "A_CAL_COMP[4]", "A_CAL_COMP[3]", "A_CAL_COMP[2]", "A_CAL_COMP[1]", "A_CAL_COMP[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_AUTOCALCOMP, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_AUTOCALCOMP, &data), TAG, "Register dump failed");
     debug_print_reg("Auto Cal. Comp. Result", DRV2605_REG_AUTOCALCOMP, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "A_CAL_BEMF[7]", "A_CAL_BEMF[6]", "A_CAL_BEMF[5]", "A_CAL_BEMF[4]", "A_CAL_BEMF[3]", "A_CAL_BEMF[2]", "A_CAL_BEMF[1]", "A_CAL_BEMF[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_AUTOCALEMP, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_AUTOCALEMP, &data), TAG, "Register dump failed");
     debug_print_reg("Auto Cal. Back-EMF Res.", DRV2605_REG_AUTOCALEMP, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "N_ERM_LRA", "FB_BRAKE_FACTOR[2]", "FB_BRAKE_FACTOR[1]", "FB_BRAKE_FACTOR[0]", "LOOP_GAIN[1]", "LOOP_GAIN[0]", "BEMF_GAIN[1]", "BEMF_GAIN[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_FEEDBACK, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_FEEDBACK, &data), TAG, "Register dump failed");
     debug_print_reg("Feedback Control", DRV2605_REG_FEEDBACK, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "STARTUP_BOOST", NULL, "AC_COUPLE", "DRIVE_TIME[4]", "DRIVE_TIME[3]", "DRIVE_TIME[2]", "DRIVE_TIME[1]", "DRIVE_TIME[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_CONTROL1, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_CONTROL1, &data), TAG, "Register dump failed");
     debug_print_reg("Control1", DRV2605_REG_CONTROL1, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "BIDIR_INPUT", "BRAKE_STABILIZER", "SAMPLE_TIME[1]", "SAMPLE_TIME[0]", "BLANKING_TIME[1]", "BLANKING_TIME[0]", "IDISS_TIME[1]", "IDISS_TIME[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_CONTROL2, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_CONTROL2, &data), TAG, "Register dump failed");
     debug_print_reg("Control2", DRV2605_REG_CONTROL2, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "NG_THRESH[1]", "NG_THRESH[0]", "ERM_OPEN_LOOP", "SUPPLY_COMP_DIS", "DATA_FORMAT_RTP", "LRA_DRIVE_MODE", "N_PWM_ANALOG", "LRA_OPEN_LOOP");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_CONTROL3, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_CONTROL3, &data), TAG, "Register dump failed");
     debug_print_reg("Control3", DRV2605_REG_CONTROL3, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "ZC_DET_TIME[1]", "ZC_DET_TIME[0]", "AUTO_CAL_TIME[1]", "AUTO_CAL_TIME[0]", NULL, "OTP_STATUS", NULL, "OTP_PROGRAM");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_CONTROL4, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_CONTROL4, &data), TAG, "Register dump failed");
     debug_print_reg("Control4", DRV2605_REG_CONTROL4, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "AUTO_OL_CNT[1]", "AUTO_OL_CNT[0]", "LRA_AUTO_OPEN_LOOP", "PLAYBACK_INTERVAL", "BLANKING_TIME[3]", "BLANKING_TIME[2]", "IDISS_TIME[3]", "IDISS_TIME[2]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_CONTROL5, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_CONTROL5, &data), TAG, "Register dump failed");
     debug_print_reg("Control5", DRV2605_REG_CONTROL5, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, NULL, "OL_LRA_PERIOD[6]", "OL_LRA_PERIOD[5]", "OL_LRA_PERIOD[4]", "OL_LRA_PERIOD[3]", "OL_LRA_PERIOD[2]", "OL_LRA_PERIOD[1]", "OL_LRA_PERIOD[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_OPNLOOPPER, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_OPNLOOPPER, &data), TAG, "Register dump failed");
     debug_print_reg("LRA Open Loop Period", DRV2605_REG_OPNLOOPPER, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "VBAT[7]", "VBAT[6]", "VBAT[5]", "VBAT[4]", "VBAT[3]", "VBAT[2]", "VBAT[1]", "VBAT[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_VBAT, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_VBAT, &data), TAG, "Register dump failed");
     debug_print_reg("V(BAT) Voltage Monitor", DRV2605_REG_VBAT, descriptions, data, false);
     debug_set_reg_descriptions(descriptions, "LRA_PERIOD[7]", "LRA_PERIOD[6]", "LRA_PERIOD[5]", "LRA_PERIOD[4]", "LRA_PERIOD[3]", "LRA_PERIOD[2]", "LRA_PERIOD[1]", "LRA_PERIOD[0]");
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_LRARESON, &data));
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_LRARESON, &data), TAG, "Register dump failed");
     debug_print_reg("LRA Resonance Period", DRV2605_REG_LRARESON, descriptions, data, true);
+    return ESP_OK;
 }
 
-void haptic_reset(uint8_t ic2_port) {
-    ESP_ERROR_CHECK(i2c_modify_reg(ic2_port, DRV2605_REG_MODE, DRV2605_MASK_MODE_RESET, DRV2605_MASK_MODE_RESET));
-    uint8_t reset_in_progress = 1;
-    while (reset_in_progress != 0) {
-        if(i2c_read_reg(ic2_port, DRV2605_REG_MODE, &reset_in_progress) == ESP_OK) {
+void haptic_register_dump(uint8_t ic2_port) {
+    ESP_ERROR_CHECK(haptic_try_register_dump(ic2_port));
+}
+
+// Sets DEV_RESET and waits until it self-cleared, but no longer than until
+// `deadline`. The shadow is dropped before the reset goes out and no resync is
+// started meanwhile, it would write the old registers into the resetting device.
+static esp_err_t haptic_reset_device(uint8_t ic2_port, int64_t deadline) {
+    ESP_RETURN_ON_FALSE(ic2_port < I2C_NUM_MAX, ESP_ERR_INVALID_ARG, TAG, "Invalid I2C port %d", ic2_port);
+    i2c_shadow_invalidate(ic2_port);
+    resync_enter(ic2_port);
+    esp_err_t result = i2c_write_reg(ic2_port, DRV2605_REG_MODE, DRV2605_MASK_MODE_RESET);
+    uint8_t reset_in_progress = DRV2605_MASK_MODE_RESET;
+    while (result == ESP_OK && reset_in_progress != 0) {
+        if(esp_timer_get_time() > deadline) {
+            result = ESP_ERR_TIMEOUT;
+        } else if(i2c_read_reg(ic2_port, DRV2605_REG_MODE, &reset_in_progress) == ESP_OK) {
             reset_in_progress &= DRV2605_MASK_MODE_RESET;
         }
     }
+    // all registers are back at their defaults, MODE was shadowed while resetting
+    i2c_shadow_invalidate(ic2_port);
+    resync_leave(ic2_port);
+    return result;
+}
+
+esp_err_t haptic_try_reset(uint8_t ic2_port) {
+    return haptic_reset_device(ic2_port, esp_timer_get_time() + DRV2605_RESET_TIMEOUT_MS * 1000);
+}
+
+void haptic_reset(uint8_t ic2_port) {
+    ESP_ERROR_CHECK(haptic_try_reset(ic2_port));
+}
+
+// A reset of the device (brown out, ESD) puts it back into standby with all
+// registers at their defaults. If that happened the shadowed registers are
+// written back in as few bursts as possible.
+esp_err_t haptic_try_resync(uint8_t ic2_port) {
+    uint8_t expected_mode;
+    if(!i2c_shadow_get(ic2_port, DRV2605_REG_MODE, &expected_mode)) {
+        // nothing known to restore
+        return ESP_OK;
+    }
+    if(!resync_enter(ic2_port)) {
+        // another task is restoring or resetting the device right now
+        resync_leave(ic2_port);
+        return ESP_OK;
+    }
+    uint8_t mode;
+    esp_err_t result = i2c_read_reg(ic2_port, DRV2605_REG_MODE, &mode);
+    if(result != ESP_OK || (mode & DRV2605_MASK_MODE_STANDBY) == (expected_mode & DRV2605_MASK_MODE_STANDBY)) {
+        // the read refreshed the shadow, put back what the driver expects
+        i2c_shadow_update(ic2_port, DRV2605_REG_MODE, expected_mode);
+        resync_leave(ic2_port);
+        return result;
+    }
+    ESP_LOGW(TAG, "Device on port %d was reset, restoring registers", ic2_port);
+    portENTER_CRITICAL(&driver_lock);
+    error_stats[ic2_port].resyncs++;
+    reg_shadow_t shadow = reg_shadow[ic2_port];
+    portEXIT_CRITICAL(&driver_lock);
+    shadow.value[DRV2605_REG_MODE] = expected_mode;
+    // MODE first so the device is out of standby when the rest arrives
+    result = i2c_write_reg(ic2_port, DRV2605_REG_MODE, expected_mode);
+    uint8_t reg = DRV2605_REG_MODE + 1;
+    while(result == ESP_OK && reg < DRV2605_REG_COUNT) {
+        if(!((shadow.valid >> reg) & 0x01)) {
+            reg++;
+            continue;
+        }
+        uint8_t first = reg;
+        while(reg < DRV2605_REG_COUNT && ((shadow.valid >> reg) & 0x01)) {
+            reg++;
+        }
+        result = i2c_write_reg_seq(ic2_port, first, &shadow.value[first], reg - first);
+    }
+    resync_leave(ic2_port);
+    return result;
+}
+
+void haptic_invalidate_shadow(uint8_t ic2_port) {
+    i2c_shadow_invalidate(ic2_port);
+}
+
+esp_err_t haptic_try_set_mode(uint8_t ic2_port, DRV2605_mode_t mode) {
+    return i2c_modify_reg(ic2_port, DRV2605_REG_MODE, mode, DRV2605_MASK_MODE_MODE);
 }
 
 void haptic_set_mode(uint8_t ic2_port, DRV2605_mode_t mode) {
-    ESP_ERROR_CHECK(i2c_modify_reg(ic2_port, DRV2605_REG_MODE, mode, DRV2605_MASK_MODE_MODE));
+    ESP_ERROR_CHECK(haptic_try_set_mode(ic2_port, mode));
+}
+
+esp_err_t haptic_try_set_standby(uint8_t ic2_port, bool standby) {
+    return i2c_modify_reg(ic2_port, DRV2605_REG_MODE, (standby << 6), DRV2605_MASK_MODE_STANDBY);
 }
 
 void haptic_set_standby(uint8_t ic2_port, bool standby) {
-    ESP_ERROR_CHECK(i2c_modify_reg(ic2_port, DRV2605_REG_MODE, (standby << 6), DRV2605_MASK_MODE_STANDBY));
+    ESP_ERROR_CHECK(haptic_try_set_standby(ic2_port, standby));
+}
+
+esp_err_t haptic_try_select_library(uint8_t ic2_port, DRV2605_library_t lib) {
+    return i2c_modify_reg(ic2_port, DRV2605_REG_LIBRARY, lib, DRV2605_MASK_LIBRARY_SEL);
 }
 
 void haptic_select_library(uint8_t ic2_port, DRV2605_library_t lib) {
-    ESP_ERROR_CHECK(i2c_modify_reg(ic2_port, DRV2605_REG_LIBRARY, lib, DRV2605_MASK_LIBRARY_SEL));
+    ESP_ERROR_CHECK(haptic_try_select_library(ic2_port, lib));
+}
+
+esp_err_t haptic_try_realtime(uint8_t ic2_port, int8_t input) {
+    return i2c_write_reg(ic2_port, DRV2605_REG_RTPIN, (uint8_t) input);
 }
 
 void haptic_realtime(uint8_t ic2_port, int8_t input) {
-    ESP_ERROR_CHECK(i2c_write_reg(ic2_port, DRV2605_REG_RTPIN, (uint8_t) input));
+    ESP_ERROR_CHECK(haptic_try_realtime(ic2_port, input));
+}
+
+esp_err_t haptic_try_go(uint8_t ic2_port) {
+    return i2c_write_reg(ic2_port, DRV2605_REG_GO, 1);
 }
 
 void haptic_go(uint8_t ic2_port) {
-    ESP_ERROR_CHECK(i2c_write_reg(ic2_port, DRV2605_REG_GO, 1));
+    ESP_ERROR_CHECK(haptic_try_go(ic2_port));
+}
+
+esp_err_t haptic_try_set_waveform(uint8_t ic2_port, uint8_t slot, DRV2605_effect_t effect) {
+    return i2c_write_reg(ic2_port, DRV2605_REG_WAVESEQ1 + slot, effect & 0x7F);
 }
 
 void haptic_set_waveform(uint8_t ic2_port, uint8_t slot, DRV2605_effect_t effect) {
-    ESP_ERROR_CHECK(i2c_write_reg(ic2_port, DRV2605_REG_WAVESEQ1 + slot, effect & 0x7F));
+    ESP_ERROR_CHECK(haptic_try_set_waveform(ic2_port, slot, effect));
 }
 
-void haptic_set_delay(uint8_t ic2_port, uint8_t slot, uint16_t delay_ms) {
+esp_err_t haptic_try_set_sequence(uint8_t ic2_port, const DRV2605_effect_t* effects, uint8_t count) {
+    uint8_t sequence[DRV2605_SEQUENCE_LENGTH];
+    if(count > DRV2605_SEQUENCE_LENGTH) {
+        count = DRV2605_SEQUENCE_LENGTH;
+    }
+    for(uint8_t i = 0; i < count; i++) {
+        sequence[i] = effects[i] & 0x7F;
+    }
+    uint8_t length = count;
+    if(length < DRV2605_SEQUENCE_LENGTH) {
+        // terminate the sequence so left over slots from earlier effects are not played
+        sequence[length++] = DRV2605_EFFECT_STOP_SEQUENCE;
+    }
+
+    // The shadowed WAVESEQ registers tell what is resident in the sequencer.
+    // Slots behind the stop are never played, so only the slots up to it count.
+    uint8_t first = DRV2605_SEQUENCE_LENGTH;
+    uint8_t last = 0;
+    for(uint8_t i = 0; i < length; i++) {
+        uint8_t resident;
+        if(!i2c_shadow_get(ic2_port, DRV2605_REG_WAVESEQ1 + i, &resident) || resident != sequence[i]) {
+            if(first == DRV2605_SEQUENCE_LENGTH) {
+                first = i;
+            }
+            last = i;
+        }
+    }
+    uint8_t slots = first == DRV2605_SEQUENCE_LENGTH ? 0 : last - first + 1;
+    if(slots != 0) {
+        ESP_RETURN_ON_ERROR(i2c_write_reg_seq(ic2_port, DRV2605_REG_WAVESEQ1 + first, &sequence[first], slots), TAG, "Could not load sequence");
+    }
+    if(ic2_port < I2C_NUM_MAX) {
+        portENTER_CRITICAL(&driver_lock);
+        sequence_cache_stats[ic2_port].loads++;
+        sequence_cache_stats[ic2_port].hits += slots == 0;
+        sequence_cache_stats[ic2_port].slots_written += slots;
+        portEXIT_CRITICAL(&driver_lock);
+    }
+    return ESP_OK;
+}
+
+void haptic_get_sequence_cache_stats(uint8_t ic2_port, DRV2605_sequence_cache_stats_t* stats) {
+    if(ic2_port < I2C_NUM_MAX) {
+        portENTER_CRITICAL(&driver_lock);
+        *stats = sequence_cache_stats[ic2_port];
+        portEXIT_CRITICAL(&driver_lock);
+    }
+}
+
+void haptic_set_sequence(uint8_t ic2_port, const DRV2605_effect_t* effects, uint8_t count) {
+    ESP_ERROR_CHECK(haptic_try_set_sequence(ic2_port, effects, count));
+}
+
+esp_err_t haptic_try_set_delay(uint8_t ic2_port, uint8_t slot, uint16_t delay_ms) {
     uint8_t delay_value = delay_ms / 10;
-    ESP_ERROR_CHECK(i2c_write_reg(ic2_port, DRV2605_REG_WAVESEQ1 + slot, 0x80 | delay_value));
+    return i2c_write_reg(ic2_port, DRV2605_REG_WAVESEQ1 + slot, 0x80 | delay_value);
+}
+
+void haptic_set_delay(uint8_t ic2_port, uint8_t slot, uint16_t delay_ms) {
+    ESP_ERROR_CHECK(haptic_try_set_delay(ic2_port, slot, delay_ms));
+}
+
+esp_err_t haptic_try_configure_offsets(uint8_t ic2_port, DRV2605_offsets_t offsets) {
+    ESP_RETURN_ON_ERROR(i2c_write_reg(ic2_port, DRV2605_REG_OVERDRIVE, (uint8_t) offsets.overdrive_time_offset), TAG, "Could not set overdrive offset");
+    ESP_RETURN_ON_ERROR(i2c_write_reg(ic2_port, DRV2605_REG_SUSTAINPOS, (uint8_t) offsets.sustain_time_offset_positive), TAG, "Could not set positive sustain offset");
+    ESP_RETURN_ON_ERROR(i2c_write_reg(ic2_port, DRV2605_REG_SUSTAINNEG, (uint8_t) offsets.sustain_time_offset_negative), TAG, "Could not set negative sustain offset");
+    ESP_RETURN_ON_ERROR(i2c_write_reg(ic2_port, DRV2605_REG_BREAK, (uint8_t) offsets.break_time_offset), TAG, "Could not set break offset");
+    return ESP_OK;
 }
 
 void haptic_configure_offsets(uint8_t ic2_port, DRV2605_offsets_t offsets) {
-    ESP_ERROR_CHECK(i2c_write_reg(ic2_port, DRV2605_REG_OVERDRIVE, (uint8_t) offsets.overdrive_time_offset));
-    ESP_ERROR_CHECK(i2c_write_reg(ic2_port, DRV2605_REG_SUSTAINPOS, (uint8_t) offsets.sustain_time_offset_positive));
-    ESP_ERROR_CHECK(i2c_write_reg(ic2_port, DRV2605_REG_SUSTAINNEG, (uint8_t) offsets.sustain_time_offset_negative));
-    ESP_ERROR_CHECK(i2c_write_reg(ic2_port, DRV2605_REG_BREAK, (uint8_t) offsets.break_time_offset));
+    ESP_ERROR_CHECK(haptic_try_configure_offsets(ic2_port, offsets));
+}
+
+esp_err_t haptic_try_set_motor_type(uint8_t ic2_port, DRV2605_motor_type_t motor_type) {
+    return i2c_modify_reg(ic2_port, DRV2605_REG_FEEDBACK, (motor_type << 7), DRV2605_MASK_FEEDBACK_ERM_LRA);
 }
 
 void haptic_set_motor_type(uint8_t ic2_port, DRV2605_motor_type_t motor_type) {
-    ESP_ERROR_CHECK(i2c_modify_reg(ic2_port, DRV2605_REG_FEEDBACK, (motor_type << 7), DRV2605_MASK_FEEDBACK_ERM_LRA));
+    ESP_ERROR_CHECK(haptic_try_set_motor_type(ic2_port, motor_type));
+}
+
+// For an LRA DRIVE_TIME is half the resonance period, in steps of 0.1 ms from 0.5 ms
+static uint8_t haptic_LRA_drive_time(double f_res) {
+    double drive_time = round(((0.5 * (1.0 / f_res)) - 0.0005) / 0.0001);
+    if(drive_time < 0) {
+        return 0;
+    }
+    if(drive_time > DRV2605_MASK_CONTROL1_DRIVE_TIME) {
+        return DRV2605_MASK_CONTROL1_DRIVE_TIME;
+    }
+    return drive_time;
 }
 
 void haptic_calculate_LRA_calibration(DRV2605_autocalibration_inputs_t* configuration, double v_rated, double v_max, double f_res) {
     configuration->od_clamp = round(v_max / 21.22E-3);
     double t = 0.00015 + 0.00005 * configuration->sample_time;
     configuration->rated_voltage = round((sqrt(1.0 - (4.0 * t + 300E-6) * ((double)f_res)) * v_rated) / 20.58E-3);
-    configuration->drive_time = round(((0.5 * (1.0 / f_res)) - 0.001) / 0.0002);
+    configuration->drive_time = haptic_LRA_drive_time(f_res);
 }
 
 void haptic_calculate_ERM_calibration(DRV2605_autocalibration_inputs_t* configuration, double v_rated, double v_max, double drive_time_ms) {
@@ -257,68 +756,88 @@ void haptic_calculate_ERM_calibration(DRV2605_autocalibration_inputs_t* configur
     configuration->rated_voltage = round(v_rated / 21.18E-3);
 }
 
-void haptic_set_calibration_inputs(uint8_t ic2_port, DRV2605_autocalibration_inputs_t* configuration) {
-    uint8_t temp =
-        ((configuration->loop_gain << 2) & DRV2605_MASK_FEEDBACK_LOOP_GAIN) |
-        ((configuration->break_factor << 4) & DRV2605_MASK_FEEDBACK_BREAK_FACTOR);
-    ESP_ERROR_CHECK(i2c_modify_reg(ic2_port, DRV2605_REG_FEEDBACK, temp, DRV2605_MASK_FEEDBACK_BREAK_FACTOR | DRV2605_MASK_FEEDBACK_LOOP_GAIN));
-    ESP_ERROR_CHECK(i2c_write_reg(ic2_port, DRV2605_REG_RATEDV, configuration->rated_voltage));
-    ESP_ERROR_CHECK(i2c_write_reg(ic2_port, DRV2605_REG_CLAMPV, configuration->od_clamp));
-    temp =
-        ((configuration->auto_cal_time << 4) & DRV2605_MASK_CONTROL4_AUTO_CAL_TIME) |
-        ((configuration->ZC_det_time << 6) & DRV2605_MASK_CONTROL4_ZC_DET_TIME);
-    ESP_ERROR_CHECK(i2c_modify_reg(ic2_port, DRV2605_REG_CONTROL4, temp, DRV2605_MASK_CONTROL4_AUTO_CAL_TIME | DRV2605_MASK_CONTROL4_ZC_DET_TIME));
-    ESP_ERROR_CHECK(i2c_modify_reg(ic2_port, DRV2605_REG_CONTROL1, configuration->drive_time, DRV2605_MASK_CONTROL1_DRIVE_TIME));
-    temp =
+// Merges the calibration inputs into `block`, which holds the registers
+// DRV2605_REG_RATEDV up to DRV2605_REG_CONTROL5
+static void haptic_pack_calibration_inputs(const DRV2605_autocalibration_inputs_t* configuration, uint8_t* block) {
+    uint8_t* reg = block - DRV2605_REG_RATEDV;
+    reg[DRV2605_REG_RATEDV] = configuration->rated_voltage;
+    reg[DRV2605_REG_CLAMPV] = configuration->od_clamp;
+    reg[DRV2605_REG_FEEDBACK] &= ~(DRV2605_MASK_FEEDBACK_BREAK_FACTOR | DRV2605_MASK_FEEDBACK_LOOP_GAIN);
+    reg[DRV2605_REG_FEEDBACK] |=
+        ((configuration->break_factor << 4) & DRV2605_MASK_FEEDBACK_BREAK_FACTOR) |
+        ((configuration->loop_gain << 2) & DRV2605_MASK_FEEDBACK_LOOP_GAIN);
+    reg[DRV2605_REG_CONTROL1] &= ~DRV2605_MASK_CONTROL1_DRIVE_TIME;
+    reg[DRV2605_REG_CONTROL1] |= configuration->drive_time & DRV2605_MASK_CONTROL1_DRIVE_TIME;
+    reg[DRV2605_REG_CONTROL2] &= ~(DRV2605_MASK_CONTROL2_SAMPLE_TIME | DRV2605_MASK_CONTROL2_BLANKING_TIME | DRV2605_MASK_CONTROL2_IDISS_TIME);
+    reg[DRV2605_REG_CONTROL2] |=
         ((configuration->sample_time << 4) & DRV2605_MASK_CONTROL2_SAMPLE_TIME) |
         ((configuration->blanking_time << 2) & DRV2605_MASK_CONTROL2_BLANKING_TIME) |
         (configuration->IDISS_time & DRV2605_MASK_CONTROL2_IDISS_TIME);
-    ESP_ERROR_CHECK(i2c_modify_reg(
-        ic2_port,
-        DRV2605_REG_CONTROL2,
-        temp,
-        DRV2605_MASK_CONTROL2_SAMPLE_TIME | DRV2605_MASK_CONTROL2_BLANKING_TIME | DRV2605_MASK_CONTROL2_IDISS_TIME
-    ));
-    temp =
+    reg[DRV2605_REG_CONTROL4] &= ~(DRV2605_MASK_CONTROL4_AUTO_CAL_TIME | DRV2605_MASK_CONTROL4_ZC_DET_TIME);
+    reg[DRV2605_REG_CONTROL4] |=
+        ((configuration->auto_cal_time << 4) & DRV2605_MASK_CONTROL4_AUTO_CAL_TIME) |
+        ((configuration->ZC_det_time << 6) & DRV2605_MASK_CONTROL4_ZC_DET_TIME);
+    reg[DRV2605_REG_CONTROL5] &= ~(DRV2605_MASK_CONTROL5_IDISS_TIME | DRV2605_MASK_CONTROL5_BLANKING_TIME);
+    reg[DRV2605_REG_CONTROL5] |=
         (((configuration->IDISS_time & 0x0C) >> 2) & DRV2605_MASK_CONTROL5_IDISS_TIME) |
         (configuration->blanking_time & DRV2605_MASK_CONTROL5_BLANKING_TIME);
-    ESP_ERROR_CHECK(i2c_modify_reg(
-        ic2_port,
-        DRV2605_REG_CONTROL5,
-        temp,
-        DRV2605_MASK_CONTROL5_IDISS_TIME | DRV2605_MASK_CONTROL5_BLANKING_TIME
-    ));
 }
 
-bool haptic_calibrate(uint8_t ic2_port, DRV2605_autocalibration_inputs_t* configuration) {
-    haptic_set_mode(ic2_port, DRV2605_MODE_AUTO_CALIBRATION);
-    haptic_set_calibration_inputs(ic2_port, configuration);
-    haptic_go(ic2_port);
-    uint8_t calibration_running = 1;
-    while (calibration_running != 0) {
-        ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_GO, &calibration_running));
-    }
-    uint8_t status;
-    ESP_ERROR_CHECK(i2c_read_reg(ic2_port, DRV2605_REG_STATUS, &status));
-    return (status & 0x08) != 0;
+esp_err_t haptic_try_set_calibration_inputs(uint8_t ic2_port, DRV2605_autocalibration_inputs_t* configuration) {
+    // RATEDV up to CONTROL5 are contiguous, so they are read, modified and written back as one block
+    uint8_t block[DRV2605_REG_CONTROL5 - DRV2605_REG_RATEDV + 1];
+    ESP_RETURN_ON_ERROR(i2c_read_reg_seq(ic2_port, DRV2605_REG_RATEDV, block, sizeof(block)), TAG, "Could not read calibration inputs");
+    haptic_pack_calibration_inputs(configuration, block);
+    ESP_RETURN_ON_ERROR(i2c_write_reg_seq(ic2_port, DRV2605_REG_RATEDV, block, sizeof(block)), TAG, "Could not write calibration inputs");
+    return ESP_OK;
 }
 
-DRV2605_autocalibration_inputs_t haptic_init(uint8_t ic2_port, DRV2605_motor_type_t motor_type) {
-    uint16_t tries = 0;
-    uint8_t dummy;
-    while(tries < 1000) {
-        if(i2c_read_reg(ic2_port, DRV2605_REG_STATUS, &dummy) == ESP_OK) {
-            break;
-        }
+void haptic_set_calibration_inputs(uint8_t ic2_port, DRV2605_autocalibration_inputs_t* configuration) {
+    ESP_ERROR_CHECK(haptic_try_set_calibration_inputs(ic2_port, configuration));
+}
+
+// Starts the calibration and waits until the device cleared GO again
+static esp_err_t haptic_run_calibration(uint8_t ic2_port) {
+    ESP_RETURN_ON_ERROR(haptic_try_go(ic2_port), TAG, "Could not start calibration");
+    int64_t deadline = esp_timer_get_time() + DRV2605_CALIBRATION_TIMEOUT_MS * 1000;
+    uint8_t go = 1;
+    while (go != 0) {
+        ESP_RETURN_ON_FALSE(esp_timer_get_time() < deadline, ESP_ERR_TIMEOUT, TAG, "Calibration did not finish");
+        ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_GO, &go), TAG, "Could not poll calibration");
     }
-    haptic_set_standby(ic2_port, false);
-    haptic_set_motor_type(ic2_port, motor_type);
-    if(motor_type == DRV2605_MOTOR_TYPE_LRA) {
-        haptic_select_library(ic2_port, DRV2605_LIBRARY_LRA);
-    } else {
-        haptic_select_library(ic2_port, DRV2605_LIBRARY_TS2200_LIB_A);
+    return ESP_OK;
+}
+
+esp_err_t haptic_try_calibrate(uint8_t ic2_port, DRV2605_autocalibration_inputs_t* configuration, bool* success) {
+    ESP_RETURN_ON_FALSE(ic2_port < I2C_NUM_MAX, ESP_ERR_INVALID_ARG, TAG, "Invalid I2C port %d", ic2_port);
+    ESP_RETURN_ON_ERROR(haptic_try_set_mode(ic2_port, DRV2605_MODE_AUTO_CALIBRATION), TAG, "Could not enter calibration mode");
+    ESP_RETURN_ON_ERROR(haptic_try_set_calibration_inputs(ic2_port, configuration), TAG, "Could not set calibration inputs");
+    // the device overwrites the results while it calibrates, a resync must not restore them
+    portENTER_CRITICAL(&driver_lock);
+    reg_shadow[ic2_port].valid &= ~DRV2605_CALIBRATION_REGS;
+    calibration_running[ic2_port] = true;
+    portEXIT_CRITICAL(&driver_lock);
+    esp_err_t result = haptic_run_calibration(ic2_port);
+    calibration_running[ic2_port] = false;
+    ESP_RETURN_ON_ERROR(result, TAG, "Calibration failed");
+    uint8_t status;
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_STATUS, &status), TAG, "Could not read calibration result");
+    *success = (status & 0x08) != 0;
+    if(*success) {
+        // AUTOCALCOMP up to FEEDBACK are contiguous, the read puts the results into the shadow
+        uint8_t results[DRV2605_REG_FEEDBACK - DRV2605_REG_AUTOCALCOMP + 1];
+        ESP_RETURN_ON_ERROR(i2c_read_reg_seq(ic2_port, DRV2605_REG_AUTOCALCOMP, results, sizeof(results)), TAG, "Could not read calibration results");
     }
+    return ESP_OK;
+}
+
+bool haptic_calibrate(uint8_t ic2_port, DRV2605_autocalibration_inputs_t* configuration) {
+    bool success;
+    ESP_ERROR_CHECK(haptic_try_calibrate(ic2_port, configuration, &success));
+    return success;
+}
 
+static DRV2605_autocalibration_inputs_t haptic_default_calibration_inputs(DRV2605_motor_type_t motor_type) {
     // populate with recomended defaults from data sheet
     DRV2605_autocalibration_inputs_t cal_settings = {
         .motor_type = motor_type,
@@ -336,8 +855,350 @@ DRV2605_autocalibration_inputs_t haptic_init(uint8_t ic2_port, DRV2605_motor_typ
     return cal_settings;
 }
 
+esp_err_t haptic_try_init(uint8_t ic2_port, DRV2605_motor_type_t motor_type, DRV2605_autocalibration_inputs_t* cal_settings) {
+    uint16_t tries = 0;
+    uint8_t dummy;
+    esp_err_t result = ESP_FAIL;
+    while(tries < 1000 && result != ESP_OK) {
+        result = i2c_read_reg(ic2_port, DRV2605_REG_STATUS, &dummy);
+        tries++;
+    }
+    ESP_RETURN_ON_ERROR(result, TAG, "No device found on port %d", ic2_port);
+    ESP_RETURN_ON_ERROR(haptic_try_set_standby(ic2_port, false), TAG, "Could not leave standby");
+    ESP_RETURN_ON_ERROR(haptic_try_set_motor_type(ic2_port, motor_type), TAG, "Could not set motor type");
+    if(motor_type == DRV2605_MOTOR_TYPE_LRA) {
+        ESP_RETURN_ON_ERROR(haptic_try_select_library(ic2_port, DRV2605_LIBRARY_LRA), TAG, "Could not select library");
+    } else {
+        ESP_RETURN_ON_ERROR(haptic_try_select_library(ic2_port, DRV2605_LIBRARY_TS2200_LIB_A), TAG, "Could not select library");
+    }
+
+    *cal_settings = haptic_default_calibration_inputs(motor_type);
+    return ESP_OK;
+}
+
+DRV2605_autocalibration_inputs_t haptic_init(uint8_t ic2_port, DRV2605_motor_type_t motor_type) {
+    DRV2605_autocalibration_inputs_t cal_settings;
+    ESP_ERROR_CHECK(haptic_try_init(ic2_port, motor_type, &cal_settings));
+    return cal_settings;
+}
+
+// Updates the total start up time and tells if the deadline passed
+static esp_err_t haptic_startup_check_deadline(int64_t start, int64_t deadline, DRV2605_startup_timing_t* timing) {
+    int64_t now = esp_timer_get_time();
+    timing->total_us = now - start;
+    return now <= deadline ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+// Program phase of the cold start, every burst is only started while there is budget left
+static esp_err_t haptic_startup_program(uint8_t ic2_port, const DRV2605_startup_config_t* config, const DRV2605_autocalibration_inputs_t* calibration, int64_t start, int64_t deadline, DRV2605_startup_timing_t* timing) {
+    // MODE, RTPIN and LIBRARY are contiguous and fully owned by the driver, so
+    // they are written in one burst: out of standby, internal trigger, no RTP input
+    uint8_t head[] = {DRV2605_MODE_INTERNAL_TRIGGER, 0x00, config->library & DRV2605_MASK_LIBRARY_SEL};
+    ESP_RETURN_ON_ERROR(haptic_startup_check_deadline(start, deadline, timing), TAG, "Deadline passed before programming mode and library");
+    ESP_RETURN_ON_ERROR(i2c_write_reg_seq(ic2_port, DRV2605_REG_MODE, head, sizeof(head)), TAG, "Could not program mode and library");
+    uint8_t block[DRV2605_REG_CONTROL5 - DRV2605_REG_RATEDV + 1];
+    ESP_RETURN_ON_ERROR(haptic_startup_check_deadline(start, deadline, timing), TAG, "Deadline passed before reading calibration inputs");
+    ESP_RETURN_ON_ERROR(i2c_read_reg_seq(ic2_port, DRV2605_REG_RATEDV, block, sizeof(block)), TAG, "Could not read calibration inputs");
+    haptic_pack_calibration_inputs(calibration, block);
+    uint8_t* feedback = &block[DRV2605_REG_FEEDBACK - DRV2605_REG_RATEDV];
+    *feedback &= ~DRV2605_MASK_FEEDBACK_ERM_LRA;
+    *feedback |= (config->motor_type << 7) & DRV2605_MASK_FEEDBACK_ERM_LRA;
+    ESP_RETURN_ON_ERROR(haptic_startup_check_deadline(start, deadline, timing), TAG, "Deadline passed before programming calibration inputs");
+    ESP_RETURN_ON_ERROR(i2c_write_reg_seq(ic2_port, DRV2605_REG_RATEDV, block, sizeof(block)), TAG, "Could not program calibration inputs");
+    return haptic_startup_check_deadline(start, deadline, timing);
+}
+
+// Body of haptic_cold_start, runs while the transfer deadline of the port is set
+static esp_err_t haptic_cold_start_bounded(uint8_t ic2_port, const DRV2605_startup_config_t* config, DRV2605_autocalibration_inputs_t* cal_settings, DRV2605_startup_timing_t* timing, int64_t start, int64_t deadline) {
+    esp_rom_delay_us(DRV2605_WAKEUP_TIME_US);
+    int64_t phase_start = esp_timer_get_time();
+    timing->wakeup_us = phase_start - start;
+
+    // Probe without the retry layer, a missing device is expected here
+    uint8_t probe = DRV2605_REG_STATUS;
+    uint8_t status;
+    uint32_t backoff_us = DRV2605_PROBE_BACKOFF_US;
+    esp_err_t result;
+    while(true) {
+        timing->probe_attempts++;
+        result = i2c_transfer_once(ic2_port, &probe, 1, &status, 1);
+        DRV2605_TRACE(DRV2605_TRACE_OP_READ, ic2_port, probe, result == ESP_OK ? status : 0, result);
+        if(result == ESP_OK) {
+            break;
+        }
+        if(esp_timer_get_time() + backoff_us > deadline) {
+            timing->total_us = esp_timer_get_time() - start;
+            ESP_LOGE(TAG, "No device found on port %d after %d probes", ic2_port, timing->probe_attempts);
+            return ESP_ERR_TIMEOUT;
+        }
+        esp_rom_delay_us(backoff_us);
+        if(backoff_us < DRV2605_PROBE_BACKOFF_MAX_US) {
+            backoff_us *= 2;
+        }
+    }
+    timing->probe_us = esp_timer_get_time() - phase_start;
+
+    if(config->reset) {
+        phase_start = esp_timer_get_time();
+        result = haptic_reset_device(ic2_port, deadline);
+        timing->reset_us = esp_timer_get_time() - phase_start;
+        timing->total_us = esp_timer_get_time() - start;
+        ESP_RETURN_ON_ERROR(result, TAG, "Could not reset device");
+    }
+
+    phase_start = esp_timer_get_time();
+    DRV2605_autocalibration_inputs_t calibration = config->calibration != NULL ?
+        *config->calibration : haptic_default_calibration_inputs(config->motor_type);
+    calibration.motor_type = config->motor_type;
+    result = haptic_startup_program(ic2_port, config, &calibration, start, deadline, timing);
+    timing->program_us = esp_timer_get_time() - phase_start;
+    ESP_RETURN_ON_ERROR(result, TAG, "Could not program device, start up took %lld us", (long long)timing->total_us);
+
+    if(cal_settings != NULL) {
+        *cal_settings = calibration;
+    }
+    return ESP_OK;
+}
+
+esp_err_t haptic_cold_start(uint8_t ic2_port, const DRV2605_startup_config_t* config, DRV2605_autocalibration_inputs_t* cal_settings, DRV2605_startup_timing_t* timing) {
+    ESP_RETURN_ON_FALSE(ic2_port < I2C_NUM_MAX, ESP_ERR_INVALID_ARG, TAG, "Invalid I2C port %d", ic2_port);
+    DRV2605_startup_timing_t local_timing = {0};
+    if(timing == NULL) {
+        timing = &local_timing;
+    }
+    *timing = (DRV2605_startup_timing_t) {0};
+    int64_t start = esp_timer_get_time();
+    int64_t deadline = start + (int64_t)config->deadline_ms * 1000;
+    // every transaction of the start up, including retries, resyncs and the
+    // reset polling, has to fit into what is left of the budget
+    transfer_deadline[ic2_port] = deadline;
+    esp_err_t result = haptic_cold_start_bounded(ic2_port, config, cal_settings, timing, start, deadline);
+    transfer_deadline[ic2_port] = 0;
+    return result;
+}
+
+esp_err_t haptic_try_click(uint8_t ic2_port) {
+    // once the click is resident only GO goes out on the bus
+    const DRV2605_effect_t click = DRV2605_EFFECT_StrongClick_100;
+    ESP_RETURN_ON_ERROR(haptic_try_set_sequence(ic2_port, &click, 1), TAG, "Could not load click");
+    return haptic_try_go(ic2_port);
+}
+
 void haptic_click(uint8_t ic2_port) {
-    haptic_set_waveform(ic2_port, 0, DRV2605_EFFECT_StrongClick_100);
-    haptic_set_waveform(ic2_port, 1, DRV2605_EFFECT_STOP_SEQUENCE);
-    haptic_go(ic2_port);
-}
\ No newline at end of file
+    ESP_ERROR_CHECK(haptic_try_click(ic2_port));
+}
+
+static void haptic_trigger_gpio_set_level(void* context, bool level) {
+    gpio_set_level((gpio_num_t)(intptr_t)context, level);
+}
+
+esp_err_t haptic_try_trigger_init_gpio(DRV2605_trigger_t* trigger, gpio_num_t pin) {
+    gpio_config_t conf = {
+        .pin_bit_mask = 1ULL << pin,
+        .mode = GPIO_MODE_OUTPUT,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    ESP_RETURN_ON_ERROR(gpio_config(&conf), TAG, "Could not configure trigger pin %d", pin);
+    ESP_RETURN_ON_ERROR(gpio_set_level(pin, 0), TAG, "Could not set trigger pin %d", pin);
+    trigger->set_level = haptic_trigger_gpio_set_level;
+    trigger->context = (void*)(intptr_t)pin;
+    return ESP_OK;
+}
+
+void haptic_trigger_init_gpio(DRV2605_trigger_t* trigger, gpio_num_t pin) {
+    ESP_ERROR_CHECK(haptic_try_trigger_init_gpio(trigger, pin));
+}
+
+esp_err_t haptic_try_arm_external_trigger(uint8_t ic2_port, const DRV2605_effect_t* effects, uint8_t count) {
+    ESP_RETURN_ON_ERROR(haptic_try_set_sequence(ic2_port, effects, count), TAG, "Could not load sequence");
+    return haptic_try_set_mode(ic2_port, DRV2605_MODE_EXTERNAL_TRIGGER);
+}
+
+void haptic_arm_external_trigger(uint8_t ic2_port, const DRV2605_effect_t* effects, uint8_t count) {
+    ESP_ERROR_CHECK(haptic_try_arm_external_trigger(ic2_port, effects, count));
+}
+
+void haptic_trigger_fire(const DRV2605_trigger_t* trigger) {
+    // Only the rising edge matters to the device, the falling edge just
+    // prepares the line for the next fire or cancel
+    trigger->set_level(trigger->context, true);
+    esp_rom_delay_us(DRV2605_TRIGGER_PULSE_US);
+    trigger->set_level(trigger->context, false);
+}
+
+void haptic_trigger_cancel(const DRV2605_trigger_t* trigger) {
+    // A second rising edge while GO is still set cancels the running sequence
+    haptic_trigger_fire(trigger);
+}
+
+void haptic_LRA_tuner_init(DRV2605_LRA_tuner_t* tuner, double f_res) {
+    tuner->threshold_hz = DRV2605_LRA_TUNER_DEFAULT_THRESHOLD_HZ;
+    tuner->filter_weight = DRV2605_LRA_TUNER_DEFAULT_FILTER_WEIGHT;
+    tuner->min_update_interval_ms = DRV2605_LRA_TUNER_DEFAULT_INTERVAL_MS;
+    tuner->f_filtered = f_res;
+    tuner->f_applied = f_res;
+    tuner->last_update_us = 0;
+    tuner->updates = 0;
+}
+
+esp_err_t haptic_try_LRA_tuner_update(uint8_t ic2_port, DRV2605_LRA_tuner_t* tuner, bool* updated) {
+    *updated = false;
+    uint8_t period;
+    ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_LRARESON, &period), TAG, "Could not read LRA period");
+    if(period == 0) {
+        // no closed loop playback happened yet, nothing was measured
+        return ESP_OK;
+    }
+    double f_measured = 1.0 / (period * DRV2605_LRA_PERIOD_STEP);
+    tuner->f_filtered += tuner->filter_weight * (f_measured - tuner->f_filtered);
+
+    // DRIVE_TIME is only touched once the resonance left the band around the
+    // frequency it was last set for and the last update is long enough ago
+    if(fabs(tuner->f_filtered - tuner->f_applied) < tuner->threshold_hz) {
+        return ESP_OK;
+    }
+    int64_t now = esp_timer_get_time();
+    if(tuner->updates != 0 && (now - tuner->last_update_us) < (int64_t)tuner->min_update_interval_ms * 1000) {
+        return ESP_OK;
+    }
+    uint8_t drive_time = haptic_LRA_drive_time(tuner->f_filtered);
+    uint8_t control1;
+    if(!i2c_shadow_get(ic2_port, DRV2605_REG_CONTROL1, &control1)) {
+        ESP_RETURN_ON_ERROR(i2c_read_reg(ic2_port, DRV2605_REG_CONTROL1, &control1), TAG, "Could not read drive time");
+    }
+    // the drift may still round to the DRIVE_TIME already set, then only the band moves
+    tuner->f_applied = tuner->f_filtered;
+    if((control1 & DRV2605_MASK_CONTROL1_DRIVE_TIME) == drive_time) {
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_ERROR(i2c_modify_reg_shadowed(ic2_port, DRV2605_REG_CONTROL1, drive_time, DRV2605_MASK_CONTROL1_DRIVE_TIME), TAG, "Could not update drive time");
+    tuner->last_update_us = now;
+    tuner->updates++;
+    *updated = true;
+    return ESP_OK;
+}
+
+bool haptic_LRA_tuner_update(uint8_t ic2_port, DRV2605_LRA_tuner_t* tuner) {
+    bool updated;
+    ESP_ERROR_CHECK(haptic_try_LRA_tuner_update(ic2_port, tuner, &updated));
+    return updated;
+}
+
+DRV2605_audio_config_t haptic_audio_preset(DRV2605_audio_preset_t preset) {
+    switch(preset) {
+        case DRV2605_AUDIO_PRESET_SUBTLE:
+            return (DRV2605_audio_config_t) {
+                .peak_time = 1, .filter = 1,
+                .min_input = 0x40, .max_input = 0xFF,
+                .min_drive = 0x10, .max_drive = 0xA0,
+            };
+        case DRV2605_AUDIO_PRESET_PUNCHY:
+            return (DRV2605_audio_config_t) {
+                .peak_time = 0, .filter = 3,
+                .min_input = 0x10, .max_input = 0xC0,
+                .min_drive = 0x30, .max_drive = 0xFF,
+            };
+        case DRV2605_AUDIO_PRESET_BASS:
+            return (DRV2605_audio_config_t) {
+                .peak_time = 3, .filter = 0,
+                .min_input = 0x19, .max_input = 0xE0,
+                .min_drive = 0x20, .max_drive = 0xFF,
+            };
+        case DRV2605_AUDIO_PRESET_DEFAULT:
+        default:
+            return (DRV2605_audio_config_t) {
+                .peak_time = 1, .filter = 1,
+                .min_input = 0x19, .max_input = 0xFF,
+                .min_drive = 0x19, .max_drive = 0xFF,
+            };
+    }
+}
+
+esp_err_t haptic_try_enter_audio_mode(uint8_t ic2_port, const DRV2605_audio_config_t* config) {
+    // AUDIOCTRL up to AUDIOOUTMAX are contiguous
+    uint8_t block[] = {
+        ((config->peak_time << 2) & DRV2605_MASK_AUDIOCTRL_PEAK_TIME) | (config->filter & DRV2605_MASK_AUDIOCTRL_FILTER),
+        config->min_input,
+        config->max_input,
+        config->min_drive,
+        config->max_drive,
+    };
+    ESP_RETURN_ON_ERROR(i2c_write_reg_seq(ic2_port, DRV2605_REG_AUDIOCTRL, block, sizeof(block)), TAG, "Could not program audio-to-vibe");
+    ESP_RETURN_ON_ERROR(i2c_modify_reg_shadowed(ic2_port, DRV2605_REG_CONTROL1, DRV2605_MASK_CONTROL1_AC_COUPLE, DRV2605_MASK_CONTROL1_AC_COUPLE), TAG, "Could not set AC_COUPLE");
+    ESP_RETURN_ON_ERROR(i2c_modify_reg_shadowed(ic2_port, DRV2605_REG_CONTROL3, DRV2605_MASK_CONTROL3_N_PWM_ANALOG, DRV2605_MASK_CONTROL3_N_PWM_ANALOG), TAG, "Could not set N_PWM_ANALOG");
+    return haptic_try_set_mode(ic2_port, DRV2605_MODE_AUDIO_VIBE);
+}
+
+void haptic_enter_audio_mode(uint8_t ic2_port, const DRV2605_audio_config_t* config) {
+    ESP_ERROR_CHECK(haptic_try_enter_audio_mode(ic2_port, config));
+}
+
+esp_err_t haptic_try_leave_audio_mode(uint8_t ic2_port, DRV2605_mode_t mode) {
+    // switch the mode first so the actuator is not driven by a DC coupled input in between
+    ESP_RETURN_ON_ERROR(haptic_try_set_mode(ic2_port, mode), TAG, "Could not leave audio-to-vibe mode");
+    ESP_RETURN_ON_ERROR(i2c_modify_reg_shadowed(ic2_port, DRV2605_REG_CONTROL1, 0, DRV2605_MASK_CONTROL1_AC_COUPLE), TAG, "Could not clear AC_COUPLE");
+    ESP_RETURN_ON_ERROR(i2c_modify_reg_shadowed(ic2_port, DRV2605_REG_CONTROL3, 0, DRV2605_MASK_CONTROL3_N_PWM_ANALOG), TAG, "Could not clear N_PWM_ANALOG");
+    return ESP_OK;
+}
+
+void haptic_leave_audio_mode(uint8_t ic2_port, DRV2605_mode_t mode) {
+    ESP_ERROR_CHECK(haptic_try_leave_audio_mode(ic2_port, mode));
+}
+
+static uint8_t haptic_audio_level_code(double level_v) {
+    double code = round(level_v * 255.0 / DRV2605_AUDIO_INPUT_FULL_SCALE);
+    if(code < 0) {
+        return 0;
+    }
+    if(code > 255) {
+        return 255;
+    }
+    return code;
+}
+
+void haptic_audio_tuner_init(DRV2605_audio_tuner_t* tuner, const DRV2605_audio_config_t* config) {
+    tuner->floor_margin = DRV2605_AUDIO_TUNER_DEFAULT_FLOOR_MARGIN;
+    tuner->filter_weight = DRV2605_AUDIO_TUNER_DEFAULT_FILTER_WEIGHT;
+    tuner->hysteresis = DRV2605_AUDIO_TUNER_DEFAULT_HYSTERESIS;
+    tuner->min_filtered = config->min_input;
+    tuner->max_filtered = config->max_input;
+    tuner->min_applied = config->min_input;
+    tuner->max_applied = config->max_input;
+    tuner->updates = 0;
+}
+
+esp_err_t haptic_try_audio_tuner_update(uint8_t ic2_port, DRV2605_audio_tuner_t* tuner, const DRV2605_audio_levels_t* levels, bool* updated) {
+    *updated = false;
+    tuner->min_filtered += tuner->filter_weight * (haptic_audio_level_code(levels->noise_floor_v * tuner->floor_margin) - tuner->min_filtered);
+    tuner->max_filtered += tuner->filter_weight * (haptic_audio_level_code(levels->peak_v) - tuner->max_filtered);
+
+    int min_input = round(tuner->min_filtered);
+    int max_input = round(tuner->max_filtered);
+    // keep a usable range even for heavily compressed material
+    if(max_input - min_input < DRV2605_AUDIO_TUNER_MIN_SPAN) {
+        max_input = min_input + DRV2605_AUDIO_TUNER_MIN_SPAN;
+        if(max_input > 255) {
+            max_input = 255;
+            min_input = 255 - DRV2605_AUDIO_TUNER_MIN_SPAN;
+        }
+    }
+    if(abs(min_input - tuner->min_applied) < tuner->hysteresis && abs(max_input - tuner->max_applied) < tuner->hysteresis) {
+        return ESP_OK;
+    }
+    // AUDIOLVL and AUDIOMAX are contiguous, both go out in one transaction
+    uint8_t thresholds[] = {min_input, max_input};
+    ESP_RETURN_ON_ERROR(i2c_write_reg_seq(ic2_port, DRV2605_REG_AUDIOLVL, thresholds, sizeof(thresholds)), TAG, "Could not update audio thresholds");
+    tuner->min_applied = min_input;
+    tuner->max_applied = max_input;
+    tuner->updates++;
+    *updated = true;
+    return ESP_OK;
+}
+
+bool haptic_audio_tuner_update(uint8_t ic2_port, DRV2605_audio_tuner_t* tuner, const DRV2605_audio_levels_t* levels) {
+    bool updated;
+    ESP_ERROR_CHECK(haptic_try_audio_tuner_update(ic2_port, tuner, levels, &updated));
+    return updated;
+}
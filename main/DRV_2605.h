@@ -3,10 +3,29 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "driver/gpio.h"
 
 #define DRV_2650_WRITE_ADDRESS 0x5A
 #define DRV_2650_READ_ADDRESS 0xB5
 #define DRV_2650_TIMEOUT 1000
+// Number of times a failed transaction is repeated before the error is returned
+#define DRV2605_MAX_RETRIES 3
+// Pause before the first retry, doubled for every further retry
+#define DRV2605_RETRY_BACKOFF_US 100
+// Clock pulses sent to free a slave which holds SDA low
+#define DRV2605_BUS_RECOVERY_CLOCKS 9
+#define DRV2605_BUS_RECOVERY_HALF_PERIOD_US 5
+#define DRV2605_RESET_TIMEOUT_MS 10
+// Longest auto calibration (AUTO_CAL_TIME = 3) plus some margin
+#define DRV2605_CALIBRATION_TIMEOUT_MS 1500
+// Time the device needs after EN went high before it accepts I2C transactions
+#define DRV2605_WAKEUP_TIME_US 250
+// Pause between two probes of a device which did not answer yet, doubled after
+// every probe up to DRV2605_PROBE_BACKOFF_MAX_US
+#define DRV2605_PROBE_BACKOFF_US 100
+#define DRV2605_PROBE_BACKOFF_MAX_US 10000
 
 
 
@@ -34,6 +53,8 @@
 #define DRV2605_REG_SUSTAINNEG 0x0F
 #define DRV2605_REG_BREAK 0x10
 #define DRV2605_REG_AUDIOCTRL 0x11
+#define DRV2605_MASK_AUDIOCTRL_PEAK_TIME 0x0C
+#define DRV2605_MASK_AUDIOCTRL_FILTER 0x03
 #define DRV2605_REG_AUDIOLVL 0x12
 #define DRV2605_REG_AUDIOMAX 0x13
 #define DRV2605_REG_AUDIOOUTMIN 0x14
@@ -45,14 +66,16 @@
 #define DRV2605_REG_FEEDBACK 0x1A
 #define DRV2605_MASK_FEEDBACK_ERM_LRA 0x80
 #define DRV2605_MASK_FEEDBACK_BREAK_FACTOR 0x70
-#define DRV2605_MASK_FEEDBACK_LOOP_GAIN 0x70
+#define DRV2605_MASK_FEEDBACK_LOOP_GAIN 0x0C
 #define DRV2605_REG_CONTROL1 0x1B
 #define DRV2605_MASK_CONTROL1_DRIVE_TIME 0x1F
+#define DRV2605_MASK_CONTROL1_AC_COUPLE 0x20
 #define DRV2605_REG_CONTROL2 0x1C
 #define DRV2605_MASK_CONTROL2_SAMPLE_TIME 0x30
 #define DRV2605_MASK_CONTROL2_BLANKING_TIME 0x0C
 #define DRV2605_MASK_CONTROL2_IDISS_TIME 0x03
 #define DRV2605_REG_CONTROL3 0x1D
+#define DRV2605_MASK_CONTROL3_N_PWM_ANALOG 0x02
 #define DRV2605_REG_CONTROL4 0x1E
 #define DRV2605_REG_CONTROL5 0x1F
 #define DRV2605_MASK_CONTROL5_BLANKING_TIME 0x0C
@@ -63,6 +86,18 @@
 #define DRV2605_REG_OPNLOOPPER 0x20
 #define DRV2605_REG_VBAT 0x21
 #define DRV2605_REG_LRARESON 0x22
+#define DRV2605_REG_COUNT 0x23
+
+// Full scale of the audio-to-vibe input level registers in volts
+#define DRV2605_AUDIO_INPUT_FULL_SCALE 1.8
+
+// Resolution of the LRA_PERIOD register in seconds
+#define DRV2605_LRA_PERIOD_STEP 98.46E-6
+
+// Number of slots in the waveform sequencer
+#define DRV2605_SEQUENCE_LENGTH 8
+// Width of the pulse generated on the IN/TRIG pin in external trigger mode
+#define DRV2605_TRIGGER_PULSE_US 1
 
 typedef enum {
     DRV2605_MOTOR_TYPE_ERM = 0x00,
@@ -465,6 +500,166 @@ typedef struct {
     uint8_t ZC_det_time;
 } DRV2605_autocalibration_inputs_t;
 
+typedef struct {
+    // Drives the IN/TRIG line to the given level. Called with `context` as
+    // first argument. Several devices can share one line, in which case a
+    // single call fires all of them at once.
+    void (*set_level)(void* context, bool level);
+    void* context;
+} DRV2605_trigger_t;
+
+#define DRV2605_LRA_TUNER_DEFAULT_THRESHOLD_HZ 2.0
+#define DRV2605_LRA_TUNER_DEFAULT_FILTER_WEIGHT 0.25
+#define DRV2605_LRA_TUNER_DEFAULT_INTERVAL_MS 1000
+
+// Keeps DRIVE_TIME matched to the resonance frequency measured by the device
+// while the LRA drifts with temperature and aging.
+typedef struct {
+    // DRIVE_TIME is only updated once the filtered resonance frequency is
+    // further than this away from the frequency it was last calculated for.
+    double threshold_hz;
+    // Weight of a new measurement in the filtered resonance frequency (0, 1]
+    double filter_weight;
+    // Minimum time between two updates of DRIVE_TIME
+    uint32_t min_update_interval_ms;
+    // #### Tuner state, managed by the driver
+    double f_filtered;
+    double f_applied;
+    int64_t last_update_us;
+    // Number of times DRIVE_TIME was actually changed
+    uint32_t updates;
+} DRV2605_LRA_tuner_t;
+
+typedef enum {
+    // Data sheet defaults
+    DRV2605_AUDIO_PRESET_DEFAULT,
+    // Only strong passages are felt, at reduced strength
+    DRV2605_AUDIO_PRESET_SUBTLE,
+    // Low threshold and fast peak detection for percussive material
+    DRV2605_AUDIO_PRESET_PUNCHY,
+    // Lowest filter corner and slow peak detection, follows the bass line
+    DRV2605_AUDIO_PRESET_BASS
+} DRV2605_audio_preset_t;
+
+typedef struct {
+    // Peak detection time of the audio-to-vibe converter
+    // 0: 10 ms
+    // 1: 20 ms
+    // 2: 30 ms
+    // 3: 40 ms
+    uint8_t peak_time;
+    // Low pass filter frequency of the audio-to-vibe converter
+    // 0: 100 Hz
+    // 1: 125 Hz
+    // 2: 150 Hz
+    // 3: 200 Hz
+    uint8_t filter;
+    // Input level below which no vibration is generated
+    // `Input level (V) = MIN_INPUT[7:0] * 1.8 V / 255`
+    uint8_t min_input;
+    // Input level mapped to the maximum drive
+    // `Input level (V) = MAX_INPUT[7:0] * 1.8 V / 255`
+    uint8_t max_input;
+    // Drive applied at the minimum input level
+    // `Drive (% of full scale) = MIN_DRIVE[7:0] * 100 / 255`
+    uint8_t min_drive;
+    // Drive applied at or above the maximum input level
+    // `Drive (% of full scale) = MAX_DRIVE[7:0] * 100 / 255`
+    uint8_t max_drive;
+} DRV2605_audio_config_t;
+
+// Level statistics of the audio signal at the IN/TRIG pin, gathered by the
+// host over a short window (a few hundred ms)
+typedef struct {
+    // Level of the quiet parts, for example the 10th percentile of the envelope
+    double noise_floor_v;
+    // Level of the loud parts, for example the 95th percentile of the envelope
+    double peak_v;
+} DRV2605_audio_levels_t;
+
+#define DRV2605_AUDIO_TUNER_DEFAULT_FLOOR_MARGIN 1.5
+#define DRV2605_AUDIO_TUNER_DEFAULT_FILTER_WEIGHT 0.3
+#define DRV2605_AUDIO_TUNER_DEFAULT_HYSTERESIS 4
+#define DRV2605_AUDIO_TUNER_MIN_SPAN 16
+
+// Keeps MIN_INPUT and MAX_INPUT matched to the program material
+typedef struct {
+    // MIN_INPUT is set this factor above the noise floor
+    double floor_margin;
+    // Weight of new statistics in the filtered levels (0, 1]
+    double filter_weight;
+    // Thresholds are only rewritten if one moved at least this many codes
+    uint8_t hysteresis;
+    // #### Tuner state, managed by the driver
+    double min_filtered;
+    double max_filtered;
+    uint8_t min_applied;
+    uint8_t max_applied;
+    uint32_t updates;
+} DRV2605_audio_tuner_t;
+
+typedef struct {
+    DRV2605_motor_type_t motor_type;
+    DRV2605_library_t library;
+    // Reset the device before programming it
+    bool reset;
+    // Calibration inputs to program. If NULL the defaults returned by
+    // haptic_init are used.
+    const DRV2605_autocalibration_inputs_t* calibration;
+    // Time budget for the whole start up, counted from the call
+    uint32_t deadline_ms;
+} DRV2605_startup_config_t;
+
+// Time spent in the phases of haptic_cold_start
+typedef struct {
+    int64_t wakeup_us;
+    int64_t probe_us;
+    uint16_t probe_attempts;
+    int64_t reset_us;
+    int64_t program_us;
+    int64_t total_us;
+} DRV2605_startup_timing_t;
+
+// Effectiveness of skipping already resident sequencer slots
+typedef struct {
+    // Calls to haptic_set_sequence
+    uint32_t loads;
+    // Loads which found the whole sequence resident, hits / loads is the hit rate
+    uint32_t hits;
+    uint32_t slots_written;
+} DRV2605_sequence_cache_stats_t;
+
+// Error and recovery counters of one I2C port
+typedef struct {
+    uint32_t transfers;
+    uint32_t retries;
+    // Transactions which still failed after all retries
+    uint32_t failures;
+    uint32_t bus_recoveries;
+    // Number of times a reset device was detected and its registers restored
+    uint32_t resyncs;
+    // Time spent from the first failed attempt until the transaction went
+    // through, for the last transaction which needed retries
+    int64_t last_recovery_us;
+    // Total time spent in retries
+    int64_t retry_time_us;
+} DRV2605_error_stats_t;
+
+#ifdef DRV2605_FAULT_INJECTION
+typedef enum {
+    // The next transactions are answered with a NACK
+    DRV2605_FAULT_NACK,
+    // Transactions time out until the bus was recovered
+    DRV2605_FAULT_STUCK_BUS,
+    // The device is reset before the next transaction
+    DRV2605_FAULT_DEVICE_RESET
+} DRV2605_fault_t;
+
+// Makes the next `count` transactions on the port fail with `fault`.
+// Only available when built with DRV2605_FAULT_INJECTION defined.
+void haptic_inject_fault(uint8_t ic2_port, DRV2605_fault_t fault, uint8_t count);
+#endif
+
 DRV2605_autocalibration_inputs_t haptic_init(uint8_t ic2_port, DRV2605_motor_type_t motor_type);
 void haptic_click(uint8_t ic2_port);
 void haptic_calculate_LRA_calibration(DRV2605_autocalibration_inputs_t* configuration, double v_rated, double v_max, double f_res);
@@ -472,5 +667,97 @@ void haptic_calculate_ERM_calibration(DRV2605_autocalibration_inputs_t* configur
 bool haptic_calibrate(uint8_t ic2_port, DRV2605_autocalibration_inputs_t* configuration);
 void haptic_register_dump(uint8_t ic2_port);
 void haptic_set_mode(uint8_t ic2_port, DRV2605_mode_t mode);
+// Loads up to 8 effects into the waveform sequencer. If less than 8 effects are
+// given the sequence is terminated with a stop. Slots which already hold the
+// requested effect are skipped, the rest is written in a single transaction.
+// Reloading the sequence which is already resident causes no bus traffic.
+// Residency is taken from the register shadow. A device reset is only noticed
+// if it made a transaction fail, see haptic_try_resync. If the device may have
+// been reset silently, call haptic_invalidate_shadow to force a full reload.
+void haptic_set_sequence(uint8_t ic2_port, const DRV2605_effect_t* effects, uint8_t count);
+// Sets up `trigger` to drive the IN/TRIG pin through the ESP GPIO driver
+void haptic_trigger_init_gpio(DRV2605_trigger_t* trigger, gpio_num_t pin);
+// Loads the sequence and switches the device to edge triggered mode.
+// The sequence is then played on every call to haptic_trigger_fire without any I2C traffic.
+void haptic_arm_external_trigger(uint8_t ic2_port, const DRV2605_effect_t* effects, uint8_t count);
+void haptic_trigger_fire(const DRV2605_trigger_t* trigger);
+void haptic_trigger_cancel(const DRV2605_trigger_t* trigger);
+// Initializes the tuner with default settings for an LRA calibrated to `f_res`
+void haptic_LRA_tuner_init(DRV2605_LRA_tuner_t* tuner, double f_res);
+// Call after playback finished. Reads the measured resonance period and updates
+// DRIVE_TIME if needed. Returns true if DRIVE_TIME was changed.
+bool haptic_LRA_tuner_update(uint8_t ic2_port, DRV2605_LRA_tuner_t* tuner);
+
+
+// #### Register access
+// Used by the other parts of the driver. All of them retry failed transactions
+// and keep the register shadow up to date.
+esp_err_t i2c_write_reg(uint8_t ic2_port, uint8_t reg, uint8_t value);
+esp_err_t i2c_write_reg_seq(uint8_t ic2_port, uint8_t reg, uint8_t* value, size_t length);
+esp_err_t i2c_read_reg(uint8_t ic2_port, uint8_t reg, uint8_t* data);
+esp_err_t i2c_read_reg_seq(uint8_t ic2_port, uint8_t reg, uint8_t* data, size_t length);
+// Records register content which was transferred outside of the functions above
+void i2c_shadow_update(uint8_t ic2_port, uint8_t reg, uint8_t value);
+void i2c_shadow_update_seq(uint8_t ic2_port, uint8_t reg, const uint8_t* data, size_t length);
+
+// #### Error returning variants
+// The functions above abort on any bus error. The variants below return the
+// error instead, after the transaction was retried and a stuck bus was recovered.
+esp_err_t haptic_try_init(uint8_t ic2_port, DRV2605_motor_type_t motor_type, DRV2605_autocalibration_inputs_t* cal_settings);
+esp_err_t haptic_try_click(uint8_t ic2_port);
+esp_err_t haptic_try_calibrate(uint8_t ic2_port, DRV2605_autocalibration_inputs_t* configuration, bool* success);
+esp_err_t haptic_try_set_calibration_inputs(uint8_t ic2_port, DRV2605_autocalibration_inputs_t* configuration);
+esp_err_t haptic_try_register_dump(uint8_t ic2_port);
+esp_err_t haptic_try_reset(uint8_t ic2_port);
+esp_err_t haptic_try_set_mode(uint8_t ic2_port, DRV2605_mode_t mode);
+esp_err_t haptic_try_set_standby(uint8_t ic2_port, bool standby);
+esp_err_t haptic_try_select_library(uint8_t ic2_port, DRV2605_library_t lib);
+esp_err_t haptic_try_realtime(uint8_t ic2_port, int8_t input);
+esp_err_t haptic_try_go(uint8_t ic2_port);
+esp_err_t haptic_try_set_waveform(uint8_t ic2_port, uint8_t slot, DRV2605_effect_t effect);
+esp_err_t haptic_try_set_sequence(uint8_t ic2_port, const DRV2605_effect_t* effects, uint8_t count);
+esp_err_t haptic_try_set_delay(uint8_t ic2_port, uint8_t slot, uint16_t delay_ms);
+esp_err_t haptic_try_configure_offsets(uint8_t ic2_port, DRV2605_offsets_t offsets);
+esp_err_t haptic_try_set_motor_type(uint8_t ic2_port, DRV2605_motor_type_t motor_type);
+esp_err_t haptic_try_trigger_init_gpio(DRV2605_trigger_t* trigger, gpio_num_t pin);
+esp_err_t haptic_try_arm_external_trigger(uint8_t ic2_port, const DRV2605_effect_t* effects, uint8_t count);
+esp_err_t haptic_try_LRA_tuner_update(uint8_t ic2_port, DRV2605_LRA_tuner_t* tuner, bool* updated);
+
+// Tells the driver which pins the port uses, so it can clock a stuck slave free
+// when a transaction times out. Without this a stuck bus is only retried.
+esp_err_t haptic_configure_bus_recovery(uint8_t ic2_port, gpio_num_t sda, gpio_num_t scl, bool pullup);
+// Checks if the device was reset behind the back of the driver and restores
+// the registers the driver wrote since. Done automatically before a failed
+// transaction is repeated.
+esp_err_t haptic_try_resync(uint8_t ic2_port);
+// Forgets all shadowed registers of the port, the next access to each of them
+// goes out on the bus again
+void haptic_invalidate_shadow(uint8_t ic2_port);
+void haptic_get_error_stats(uint8_t ic2_port, DRV2605_error_stats_t* stats);
+void haptic_get_sequence_cache_stats(uint8_t ic2_port, DRV2605_sequence_cache_stats_t* stats);
+
+// Returns the audio-to-vibe settings of a preset
+DRV2605_audio_config_t haptic_audio_preset(DRV2605_audio_preset_t preset);
+// Programs the audio-to-vibe converter, sets AC_COUPLE and N_PWM_ANALOG and
+// switches to DRV2605_MODE_AUDIO_VIBE. From then on the device converts the
+// signal on IN/TRIG without any bus traffic.
+esp_err_t haptic_try_enter_audio_mode(uint8_t ic2_port, const DRV2605_audio_config_t* config);
+void haptic_enter_audio_mode(uint8_t ic2_port, const DRV2605_audio_config_t* config);
+// Clears AC_COUPLE and N_PWM_ANALOG again and switches to `mode`
+esp_err_t haptic_try_leave_audio_mode(uint8_t ic2_port, DRV2605_mode_t mode);
+void haptic_leave_audio_mode(uint8_t ic2_port, DRV2605_mode_t mode);
+// Initializes the tuner to start from the thresholds in `config`
+void haptic_audio_tuner_init(DRV2605_audio_tuner_t* tuner, const DRV2605_audio_config_t* config);
+// Feeds new level statistics to the tuner. MIN_INPUT and MAX_INPUT are only
+// written if they moved by at least the hysteresis, `updated` tells if they were.
+esp_err_t haptic_try_audio_tuner_update(uint8_t ic2_port, DRV2605_audio_tuner_t* tuner, const DRV2605_audio_levels_t* levels, bool* updated);
+bool haptic_audio_tuner_update(uint8_t ic2_port, DRV2605_audio_tuner_t* tuner, const DRV2605_audio_levels_t* levels);
+
+// Brings the device up within `config->deadline_ms`: waits for the wake up time,
+// probes with backoff, optionally resets it and then programs mode, motor type,
+// library and calibration inputs in three bursts. The programmed calibration
+// inputs are returned in `cal_settings`, the time spent per phase in `timing`.
+// Both may be NULL. Returns ESP_ERR_TIMEOUT if the deadline passed.
+esp_err_t haptic_cold_start(uint8_t ic2_port, const DRV2605_startup_config_t* config, DRV2605_autocalibration_inputs_t* cal_settings, DRV2605_startup_timing_t* timing);
 
 #endif
\ No newline at end of file
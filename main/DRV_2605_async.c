@@ -0,0 +1,277 @@
+#include "DRV_2605_async.h"
+#include "DRV_2605.h"
+#include "DRV_2605_trace.h"
+#include "DRV_2605_capture.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_timer.h"
+#include "driver/i2c.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+static const char* TAG = "DRV_2605_async";
+
+typedef struct {
+    uint8_t reg;
+    uint8_t length;
+    bool read;
+    // Sent by haptic_async_deinit, the task ends once it received it
+    bool stop;
+    uint8_t data[DRV2605_ASYNC_MAX_LENGTH];
+    DRV2605_async_callback_t callback;
+    void* context;
+} async_transaction_t;
+
+typedef struct {
+    uint8_t port;
+    QueueHandle_t queue;
+    SemaphoreHandle_t idle;
+    // Given by the task right before it ends
+    SemaphoreHandle_t stopped;
+    TaskHandle_t task;
+    atomic_uint pending;
+    int64_t started_us;
+    DRV2605_async_stats_t stats;
+    // A read needs a repeated START in the middle, so every transaction can
+    // take up to two links worth of commands
+    uint8_t link[I2C_LINK_RECOMMENDED_SIZE(DRV2605_ASYNC_MAX_BATCH * 2)];
+} async_port_t;
+
+static async_port_t* async_ports[I2C_NUM_MAX];
+
+// Chains all transactions into a single command list. They are separated by
+// repeated STARTs, so there is no STOP and no idle bus time between them.
+static esp_err_t async_run_batch(async_port_t* port, async_transaction_t* batch, size_t count) {
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(port->link, sizeof(port->link));
+    if(cmd == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t result = ESP_OK;
+    for(size_t i = 0; i < count && result == ESP_OK; i++) {
+        async_transaction_t* transaction = &batch[i];
+        result |= i2c_master_start(cmd);
+        result |= i2c_master_write_byte(cmd, DRV_2650_WRITE_ADDRESS << 1 | I2C_MASTER_WRITE, true);
+        result |= i2c_master_write_byte(cmd, transaction->reg, true);
+        if(transaction->read) {
+            result |= i2c_master_start(cmd);
+            result |= i2c_master_write_byte(cmd, DRV_2650_WRITE_ADDRESS << 1 | I2C_MASTER_READ, true);
+            result |= i2c_master_read(cmd, transaction->data, transaction->length, I2C_MASTER_LAST_NACK);
+        } else {
+            result |= i2c_master_write(cmd, transaction->data, transaction->length, true);
+        }
+    }
+    result |= i2c_master_stop(cmd);
+    if(result == ESP_OK) {
+        result = i2c_master_cmd_begin(port->port, cmd, DRV_2650_TIMEOUT);
+    }
+    i2c_cmd_link_delete_static(cmd);
+    return result;
+}
+
+static void async_complete(async_port_t* port, async_transaction_t* transaction, esp_err_t result) {
+    if(transaction->callback != NULL) {
+        transaction->callback(result, transaction->data, transaction->length, transaction->context);
+    }
+    if(atomic_fetch_sub(&port->pending, 1) == 1) {
+        xSemaphoreGive(port->idle);
+    }
+}
+
+// Transactions which must not be sent twice. A batch ends with such a
+// transaction, so it is never part of what is repeated after a failed batch.
+static bool async_has_side_effect(const async_transaction_t* transaction) {
+    if(transaction->read) {
+        return false;
+    }
+    uint8_t last = transaction->reg + transaction->length - 1;
+    if(transaction->reg <= DRV2605_REG_GO && last >= DRV2605_REG_GO) {
+        return true;
+    }
+    return transaction->reg <= DRV2605_REG_MODE && last >= DRV2605_REG_MODE &&
+        (transaction->data[DRV2605_REG_MODE - transaction->reg] & DRV2605_MASK_MODE_RESET) != 0;
+}
+
+// Sends the transactions as one chain. The chained list can not tell which
+// transaction failed, so a failed chain is split in halves until the failing
+// transaction is found. That one goes through the retrying register access.
+// Only the part of the batch before the failure is sent twice.
+static void async_run(async_port_t* port, async_transaction_t* batch, size_t count) {
+    int64_t start = esp_timer_get_time();
+    esp_err_t result = async_run_batch(port, batch, count);
+    int64_t end = esp_timer_get_time();
+    port->stats.busy_us += end - start;
+    port->stats.batches++;
+#if DRV2605_CAPTURE_ENABLED
+    for(size_t i = 0; i < count; i++) {
+        uint8_t flags = (batch[i].read ? DRV2605_CAPTURE_FLAG_READ : 0) | (i > 0 ? DRV2605_CAPTURE_FLAG_CHAINED : 0);
+        bool has_data = !batch[i].read || result == ESP_OK;
+        DRV2605_CAPTURE(port->port, flags, batch[i].reg, batch[i].data, has_data ? batch[i].length : 0, result, start, i == 0 ? end : start);
+    }
+#endif
+    if(result == ESP_OK) {
+        for(size_t i = 0; i < count; i++) {
+            async_transaction_t* transaction = &batch[i];
+            DRV2605_TRACE(transaction->read ? DRV2605_TRACE_OP_READ_SEQ : DRV2605_TRACE_OP_WRITE_SEQ,
+                port->port, transaction->reg, transaction->length, ESP_OK);
+            i2c_shadow_update_seq(port->port, transaction->reg, transaction->data, transaction->length);
+            async_complete(port, transaction, ESP_OK);
+        }
+        return;
+    }
+    port->stats.fallbacks++;
+    if(count > 1) {
+        size_t half = count / 2;
+        async_run(port, batch, half);
+        async_run(port, &batch[half], count - half);
+        return;
+    }
+    start = esp_timer_get_time();
+    if(batch->read) {
+        result = i2c_read_reg_seq(port->port, batch->reg, batch->data, batch->length);
+    } else {
+        result = i2c_write_reg_seq(port->port, batch->reg, batch->data, batch->length);
+    }
+    port->stats.busy_us += esp_timer_get_time() - start;
+    async_complete(port, batch, result);
+}
+
+static void async_task(void* arg) {
+    async_port_t* port = arg;
+    async_transaction_t batch[DRV2605_ASYNC_MAX_BATCH];
+    bool stop = false;
+    while(!stop) {
+        xQueueReceive(port->queue, &batch[0], portMAX_DELAY);
+        stop = batch[0].stop;
+        size_t count = stop ? 0 : 1;
+        // everything queued while the last batch was on the wire goes out together
+        while(!stop && count < DRV2605_ASYNC_MAX_BATCH && !async_has_side_effect(&batch[count - 1]) &&
+            xQueueReceive(port->queue, &batch[count], 0) == pdTRUE) {
+            stop = batch[count].stop;
+            if(!stop) {
+                count++;
+            }
+        }
+        if(count == 0) {
+            continue;
+        }
+        async_run(port, batch, count);
+        port->stats.transactions += count;
+    }
+    // queued after the stop by a producer racing haptic_async_deinit
+    while(xQueueReceive(port->queue, &batch[0], 0) == pdTRUE) {
+        if(!batch[0].stop) {
+            async_complete(port, &batch[0], ESP_ERR_INVALID_STATE);
+        }
+    }
+    xSemaphoreGive(port->stopped);
+    vTaskDelete(NULL);
+}
+
+esp_err_t haptic_async_init(uint8_t ic2_port, uint8_t queue_depth) {
+    ESP_RETURN_ON_FALSE(ic2_port < I2C_NUM_MAX, ESP_ERR_INVALID_ARG, TAG, "Invalid I2C port %d", ic2_port);
+    ESP_RETURN_ON_FALSE(async_ports[ic2_port] == NULL, ESP_ERR_INVALID_STATE, TAG, "Transport of port %d already running", ic2_port);
+    async_port_t* port = calloc(1, sizeof(async_port_t));
+    ESP_RETURN_ON_FALSE(port != NULL, ESP_ERR_NO_MEM, TAG, "Could not allocate transport");
+    port->port = ic2_port;
+    atomic_init(&port->pending, 0);
+    port->started_us = esp_timer_get_time();
+    async_ports[ic2_port] = port;
+    port->queue = xQueueCreate(queue_depth, sizeof(async_transaction_t));
+    port->idle = xSemaphoreCreateBinary();
+    port->stopped = xSemaphoreCreateBinary();
+    if(port->queue == NULL || port->idle == NULL || port->stopped == NULL ||
+        xTaskCreate(async_task, "drv2605_async", DRV2605_ASYNC_TASK_STACK, port, DRV2605_ASYNC_TASK_PRIORITY, &port->task) != pdPASS) {
+        haptic_async_deinit(ic2_port);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void haptic_async_deinit(uint8_t ic2_port) {
+    if(ic2_port >= I2C_NUM_MAX || async_ports[ic2_port] == NULL) {
+        return;
+    }
+    async_port_t* port = async_ports[ic2_port];
+    async_ports[ic2_port] = NULL;
+    if(port->task != NULL) {
+        // queued behind the pending transactions, so they still go out
+        async_transaction_t stop = {.stop = true};
+        xQueueSend(port->queue, &stop, portMAX_DELAY);
+        xSemaphoreTake(port->stopped, portMAX_DELAY);
+    }
+    if(port->queue != NULL) {
+        vQueueDelete(port->queue);
+    }
+    if(port->idle != NULL) {
+        vSemaphoreDelete(port->idle);
+    }
+    if(port->stopped != NULL) {
+        vSemaphoreDelete(port->stopped);
+    }
+    free(port);
+}
+
+static esp_err_t async_submit(uint8_t ic2_port, async_transaction_t* transaction) {
+    ESP_RETURN_ON_FALSE(ic2_port < I2C_NUM_MAX && async_ports[ic2_port] != NULL, ESP_ERR_INVALID_STATE, TAG, "Transport of port %d not running", ic2_port);
+    async_port_t* port = async_ports[ic2_port];
+    atomic_fetch_add(&port->pending, 1);
+    // blocks only if the queue is full, which throttles the producer to the bus speed
+    if(xQueueSend(port->queue, transaction, pdMS_TO_TICKS(DRV_2650_TIMEOUT)) != pdTRUE) {
+        atomic_fetch_sub(&port->pending, 1);
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+esp_err_t haptic_async_write(uint8_t ic2_port, uint8_t reg, const uint8_t* data, size_t length, DRV2605_async_callback_t callback, void* context) {
+    ESP_RETURN_ON_FALSE(length > 0 && length <= DRV2605_ASYNC_MAX_LENGTH, ESP_ERR_INVALID_SIZE, TAG, "Invalid length %u", (unsigned)length);
+    async_transaction_t transaction = {
+        .reg = reg,
+        .length = length,
+        .read = false,
+        .callback = callback,
+        .context = context,
+    };
+    memcpy(transaction.data, data, length);
+    return async_submit(ic2_port, &transaction);
+}
+
+esp_err_t haptic_async_read(uint8_t ic2_port, uint8_t reg, size_t length, DRV2605_async_callback_t callback, void* context) {
+    ESP_RETURN_ON_FALSE(length > 0 && length <= DRV2605_ASYNC_MAX_LENGTH, ESP_ERR_INVALID_SIZE, TAG, "Invalid length %u", (unsigned)length);
+    async_transaction_t transaction = {
+        .reg = reg,
+        .length = length,
+        .read = true,
+        .callback = callback,
+        .context = context,
+    };
+    return async_submit(ic2_port, &transaction);
+}
+
+esp_err_t haptic_async_flush(uint8_t ic2_port, uint32_t timeout_ms) {
+    ESP_RETURN_ON_FALSE(ic2_port < I2C_NUM_MAX && async_ports[ic2_port] != NULL, ESP_ERR_INVALID_STATE, TAG, "Transport of port %d not running", ic2_port);
+    async_port_t* port = async_ports[ic2_port];
+    // drop a notification left over from an earlier idle phase
+    xSemaphoreTake(port->idle, 0);
+    if(atomic_load(&port->pending) == 0) {
+        return ESP_OK;
+    }
+    if(xSemaphoreTake(port->idle, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+void haptic_async_get_stats(uint8_t ic2_port, DRV2605_async_stats_t* stats) {
+    if(ic2_port >= I2C_NUM_MAX || async_ports[ic2_port] == NULL) {
+        *stats = (DRV2605_async_stats_t) {0};
+        return;
+    }
+    *stats = async_ports[ic2_port]->stats;
+    stats->active_us = esp_timer_get_time() - async_ports[ic2_port]->started_us;
+}
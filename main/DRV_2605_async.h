@@ -0,0 +1,52 @@
+#ifndef __DRV_2605_ASYNC_H__
+#define __DRV_2605_ASYNC_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// Largest number of bytes one queued transaction can read or write
+#define DRV2605_ASYNC_MAX_LENGTH 16
+// Largest number of queued transactions sent back to back in one bus access
+#define DRV2605_ASYNC_MAX_BATCH 8
+#define DRV2605_ASYNC_TASK_STACK 3072
+#define DRV2605_ASYNC_TASK_PRIORITY 10
+
+// Called from the transport task once the transaction finished. For reads
+// `data` holds the bytes read, for writes the bytes written.
+typedef void (*DRV2605_async_callback_t)(esp_err_t result, const uint8_t* data, size_t length, void* context);
+
+typedef struct {
+    uint32_t transactions;
+    // Number of bus accesses the transactions were sent in
+    uint32_t batches;
+    // Bus accesses which failed and were repeated in halves, or as a single
+    // transaction through the retrying register access
+    uint32_t fallbacks;
+    // Time the bus was busy with transactions from the queue
+    int64_t busy_us;
+    // Time since haptic_async_init, busy_us / active_us is the bus utilisation
+    int64_t active_us;
+} DRV2605_async_stats_t;
+
+// Starts the transport task of the port with room for `queue_depth`
+// transactions in flight. The blocking API may still be used on the port, the
+// register shadow and the statistics are shared under a lock. A read-modify-write
+// of the blocking API is not atomic against queued writes to the same register.
+esp_err_t haptic_async_init(uint8_t ic2_port, uint8_t queue_depth);
+// Stops the transport task after the transactions queued so far finished and
+// their callbacks ran. No other task may queue transactions on the port meanwhile.
+void haptic_async_deinit(uint8_t ic2_port);
+// Queues a write of `length` bytes starting at `reg` and returns immediately.
+// The data is copied, `callback` may be NULL. If a batch fails the part of it
+// before the failing transaction is sent again. Writes to GO and writes which
+// set DEV_RESET therefore always end a batch and are never sent twice this way.
+esp_err_t haptic_async_write(uint8_t ic2_port, uint8_t reg, const uint8_t* data, size_t length, DRV2605_async_callback_t callback, void* context);
+// Queues a read of `length` bytes starting at `reg`. The result is handed to `callback`.
+esp_err_t haptic_async_read(uint8_t ic2_port, uint8_t reg, size_t length, DRV2605_async_callback_t callback, void* context);
+// Waits until all queued transactions finished
+esp_err_t haptic_async_flush(uint8_t ic2_port, uint32_t timeout_ms);
+void haptic_async_get_stats(uint8_t ic2_port, DRV2605_async_stats_t* stats);
+
+#endif
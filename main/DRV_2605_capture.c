@@ -0,0 +1,90 @@
+#include "DRV_2605_capture.h"
+#include <stdio.h>
+#include <string.h>
+#include "esp_check.h"
+#include "freertos/FreeRTOS.h"
+
+static const char* TAG = "DRV_2605_capture";
+
+_Static_assert(sizeof(DRV2605_capture_header_t) == 8, "Capture header must not contain padding");
+_Static_assert(sizeof(DRV2605_capture_record_t) == 12, "Capture records must not contain padding");
+
+static portMUX_TYPE capture_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t* capture_buffer;
+static size_t capture_size;
+static size_t capture_used;
+static uint32_t capture_dropped;
+
+esp_err_t haptic_capture_start(uint8_t* buffer, size_t size) {
+    ESP_RETURN_ON_FALSE(buffer != NULL && size >= sizeof(DRV2605_capture_header_t), ESP_ERR_INVALID_SIZE, TAG, "Capture buffer too small");
+    DRV2605_capture_header_t header = {
+        .magic = DRV2605_CAPTURE_MAGIC,
+        .version = DRV2605_CAPTURE_VERSION,
+    };
+    memcpy(buffer, &header, sizeof(header));
+    portENTER_CRITICAL(&capture_lock);
+    capture_buffer = buffer;
+    capture_size = size;
+    capture_used = sizeof(header);
+    capture_dropped = 0;
+    portEXIT_CRITICAL(&capture_lock);
+    return ESP_OK;
+}
+
+size_t haptic_capture_stop(void) {
+    portENTER_CRITICAL(&capture_lock);
+    size_t used = capture_buffer != NULL ? capture_used : 0;
+    capture_buffer = NULL;
+    portEXIT_CRITICAL(&capture_lock);
+    return used;
+}
+
+uint32_t haptic_capture_dropped(void) {
+    return capture_dropped;
+}
+
+bool haptic_capture_active(void) {
+    return capture_buffer != NULL;
+}
+
+void haptic_capture_transaction(uint8_t port, uint8_t flags, uint8_t reg, const uint8_t* data, size_t length, esp_err_t result, int64_t start_us, int64_t end_us) {
+    if(capture_buffer == NULL) {
+        return;
+    }
+    int64_t duration = end_us - start_us;
+    DRV2605_capture_record_t record = {
+        .timestamp_us = (uint32_t)start_us,
+        .duration_us = duration > UINT16_MAX ? UINT16_MAX : (uint16_t)duration,
+        .port = port,
+        .flags = flags,
+        .reg = reg,
+        .length = length > UINT8_MAX ? UINT8_MAX : (uint8_t)length,
+        .result = (int16_t)result,
+    };
+    // The copy is done under the lock as well, so once haptic_capture_stop
+    // returned no record is still being written into the buffer. A record is
+    // at most a few dozen bytes.
+    portENTER_CRITICAL(&capture_lock);
+    if(capture_buffer != NULL) {
+        if(capture_used + sizeof(record) + record.length <= capture_size) {
+            uint8_t* destination = capture_buffer + capture_used;
+            memcpy(destination, &record, sizeof(record));
+            memcpy(destination + sizeof(record), data, record.length);
+            capture_used += sizeof(record) + record.length;
+        } else {
+            capture_dropped++;
+        }
+    }
+    portEXIT_CRITICAL(&capture_lock);
+}
+
+void haptic_capture_print_raw(const uint8_t* log, size_t size) {
+    const size_t bytes_per_line = 32;
+    for(size_t offset = 0; offset < size; offset += bytes_per_line) {
+        printf(DRV2605_CAPTURE_RAW_PREFIX);
+        for(size_t i = offset; i < size && i < offset + bytes_per_line; i++) {
+            printf("%02x", log[i]);
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef __DRV_2605_CAPTURE_H__
+#define __DRV_2605_CAPTURE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// Set to 0 to compile the capture hooks out of the driver
+#ifndef DRV2605_CAPTURE_ENABLED
+#define DRV2605_CAPTURE_ENABLED 1
+#endif
+
+// Prefix of the lines written by haptic_capture_print_raw.
+// tools/drv2605_capture.py picks these lines out of a serial log.
+#define DRV2605_CAPTURE_RAW_PREFIX "DRVCAP:"
+#define DRV2605_CAPTURE_MAGIC 0x50433244 // "D2CP"
+#define DRV2605_CAPTURE_VERSION 1
+
+// The transaction read from the device, otherwise it wrote to it
+#define DRV2605_CAPTURE_FLAG_READ 0x01
+// The transaction followed the previous one after a repeated START in the same
+// bus access. Its duration is accounted to the first transaction of the access.
+#define DRV2605_CAPTURE_FLAG_CHAINED 0x02
+
+// Start of a capture log
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t reserved[3];
+} DRV2605_capture_header_t;
+
+// Every transaction is stored as this header followed by `length` data bytes
+typedef struct {
+    // Lower 32 bits of esp_timer_get_time() when the transaction started
+    uint32_t timestamp_us;
+    // Time the bus access took
+    uint16_t duration_us;
+    uint8_t port;
+    uint8_t flags;
+    uint8_t reg;
+    uint8_t length;
+    int16_t result;
+} DRV2605_capture_record_t;
+
+#if DRV2605_CAPTURE_ENABLED
+#define DRV2605_CAPTURE(port, flags, reg, data, length, result, start_us, end_us) \
+    haptic_capture_transaction((port), (flags), (reg), (data), (length), (result), (start_us), (end_us))
+#else
+#define DRV2605_CAPTURE(port, flags, reg, data, length, result, start_us, end_us) do {} while(0)
+#endif
+
+// Starts recording every bus transaction of the driver into `buffer`.
+// Recording stops silently once the buffer is full.
+esp_err_t haptic_capture_start(uint8_t* buffer, size_t size);
+// Stops recording and returns the number of bytes of the log in the buffer
+size_t haptic_capture_stop(void);
+// Returns the number of transactions which did not fit into the buffer
+uint32_t haptic_capture_dropped(void);
+// Returns true while a capture is running
+bool haptic_capture_active(void);
+// Appends one transaction to the running capture, called by the I2C layer
+void haptic_capture_transaction(uint8_t port, uint8_t flags, uint8_t reg, const uint8_t* data, size_t length, esp_err_t result, int64_t start_us, int64_t end_us);
+// Prints a finished log hex encoded for tools/drv2605_capture.py
+void haptic_capture_print_raw(const uint8_t* log, size_t size);
+
+#endif
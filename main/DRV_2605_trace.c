@@ -0,0 +1,113 @@
+#include "DRV_2605_trace.h"
+#include <stdatomic.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "freertos/FreeRTOS.h"
+
+_Static_assert((DRV2605_TRACE_LENGTH & (DRV2605_TRACE_LENGTH - 1)) == 0, "DRV2605_TRACE_LENGTH must be a power of two");
+_Static_assert(sizeof(DRV2605_trace_record_t) == 12, "Trace records must not contain padding");
+
+// One ring per core so the cores never compete for the same cache lines.
+// The head only ever grows, the slot is taken from its lower bits.
+static DRV2605_trace_record_t trace_buffer[portNUM_PROCESSORS][DRV2605_TRACE_LENGTH];
+static atomic_uint trace_head[portNUM_PROCESSORS];
+
+void haptic_trace_record(uint8_t op, uint8_t port, uint8_t reg, uint8_t value, esp_err_t result) {
+    uint32_t core = xPortGetCoreID();
+    // The atomic increment hands out a unique slot even if a task or ISR on the
+    // same core interrupts us between here and the record being filled in.
+    uint32_t index = atomic_fetch_add_explicit(&trace_head[core], 1, memory_order_relaxed);
+    DRV2605_trace_record_t* record = &trace_buffer[core][index & (DRV2605_TRACE_LENGTH - 1)];
+    record->timestamp_us = (uint32_t)esp_timer_get_time();
+    record->op = op;
+    record->port = port;
+    record->reg = reg;
+    record->value = value;
+    record->result = result;
+}
+
+size_t haptic_trace_snapshot(uint8_t core, DRV2605_trace_record_t* records, size_t max_records) {
+    if(core >= portNUM_PROCESSORS) {
+        return 0;
+    }
+    uint32_t head = atomic_load_explicit(&trace_head[core], memory_order_acquire);
+    uint32_t count = head < DRV2605_TRACE_LENGTH ? head : DRV2605_TRACE_LENGTH;
+    if(count > max_records) {
+        count = max_records;
+    }
+    for(uint32_t i = 0; i < count; i++) {
+        records[i] = trace_buffer[core][(head - count + i) & (DRV2605_TRACE_LENGTH - 1)];
+    }
+    return count;
+}
+
+void haptic_trace_clear(void) {
+    for(uint8_t core = 0; core < portNUM_PROCESSORS; core++) {
+        atomic_store_explicit(&trace_head[core], 0, memory_order_release);
+    }
+}
+
+static const char* haptic_trace_op_name(uint8_t op) {
+    switch(op) {
+        case DRV2605_TRACE_OP_READ: return "READ";
+        case DRV2605_TRACE_OP_WRITE: return "WRITE";
+        case DRV2605_TRACE_OP_WRITE_SEQ: return "WRITE_SEQ";
+        case DRV2605_TRACE_OP_MODIFY: return "MODIFY";
+        case DRV2605_TRACE_OP_READ_SEQ: return "READ_SEQ";
+        default: return op >= DRV2605_TRACE_OP_USER ? "USER" : "UNKNOWN";
+    }
+}
+
+void haptic_trace_print(void) {
+    DRV2605_trace_record_t record;
+    for(uint8_t core = 0; core < portNUM_PROCESSORS; core++) {
+        uint32_t head = atomic_load_explicit(&trace_head[core], memory_order_acquire);
+        uint32_t count = head < DRV2605_TRACE_LENGTH ? head : DRV2605_TRACE_LENGTH;
+        printf("DRV2605 trace core %d: %lu records\n", core, (unsigned long)count);
+        for(uint32_t i = 0; i < count; i++) {
+            record = trace_buffer[core][(head - count + i) & (DRV2605_TRACE_LENGTH - 1)];
+            printf("%10lu us  port %d  %-9s  reg 0x%02x  value 0x%02x  %s\n",
+                (unsigned long)record.timestamp_us, record.port, haptic_trace_op_name(record.op),
+                record.reg, record.value, esp_err_to_name(record.result));
+        }
+    }
+}
+
+void haptic_trace_print_raw(void) {
+    DRV2605_trace_record_t record;
+    for(uint8_t core = 0; core < portNUM_PROCESSORS; core++) {
+        uint32_t head = atomic_load_explicit(&trace_head[core], memory_order_acquire);
+        uint32_t count = head < DRV2605_TRACE_LENGTH ? head : DRV2605_TRACE_LENGTH;
+        for(uint32_t i = 0; i < count; i++) {
+            record = trace_buffer[core][(head - count + i) & (DRV2605_TRACE_LENGTH - 1)];
+            const uint8_t* bytes = (const uint8_t*)&record;
+            printf(DRV2605_TRACE_RAW_PREFIX "%d:", core);
+            for(size_t b = 0; b < sizeof(record); b++) {
+                printf("%02x", bytes[b]);
+            }
+            printf("\n");
+        }
+    }
+}
+
+uint32_t haptic_trace_measure_cost(uint32_t iterations) {
+    if(iterations == 0) {
+        return 0;
+    }
+    // the loop itself and reading the cycle counter are measured separately and
+    // subtracted, the asm keeps the compiler from dropping the empty loop
+    esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+    for(uint32_t i = 0; i < iterations; i++) {
+        __asm__ volatile("" : : "r"(i) : "memory");
+    }
+    esp_cpu_cycle_count_t baseline = esp_cpu_get_cycle_count() - start;
+    start = esp_cpu_get_cycle_count();
+    for(uint32_t i = 0; i < iterations; i++) {
+        haptic_trace_record(DRV2605_TRACE_OP_USER, 0, 0, (uint8_t)i, ESP_OK);
+    }
+    esp_cpu_cycle_count_t cost = esp_cpu_get_cycle_count() - start;
+    // the measurement filled the ring with its own records
+    haptic_trace_clear();
+    return cost > baseline ? (cost - baseline) / iterations : 0;
+}
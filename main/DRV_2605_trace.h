@@ -0,0 +1,72 @@
+#ifndef __DRV_2605_TRACE_H__
+#define __DRV_2605_TRACE_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// Set to 0 to compile all trace points out of the driver
+#ifndef DRV2605_TRACE_ENABLED
+#define DRV2605_TRACE_ENABLED 1
+#endif
+
+// Number of records kept per core. Must be a power of two.
+#ifndef DRV2605_TRACE_LENGTH
+#define DRV2605_TRACE_LENGTH 256
+#endif
+
+// Prefix of the lines written by haptic_trace_print_raw.
+// tools/drv2605_trace.py picks these lines out of a serial log.
+#define DRV2605_TRACE_RAW_PREFIX "DRVTRACE:"
+
+typedef enum {
+    DRV2605_TRACE_OP_READ = 0x01,
+    DRV2605_TRACE_OP_WRITE = 0x02,
+    // value holds the number of bytes written
+    DRV2605_TRACE_OP_WRITE_SEQ = 0x03,
+    // value holds the register content after the modification
+    DRV2605_TRACE_OP_MODIFY = 0x04,
+    // value holds the number of bytes read
+    DRV2605_TRACE_OP_READ_SEQ = 0x05,
+    // Free for application defined events
+    DRV2605_TRACE_OP_USER = 0x80
+} DRV2605_trace_op_t;
+
+// Fixed size binary trace record. Kept at 12 bytes without padding so it can be
+// dumped and decoded as is.
+typedef struct {
+    // Lower 32 bits of esp_timer_get_time()
+    uint32_t timestamp_us;
+    uint8_t op;
+    uint8_t port;
+    uint8_t reg;
+    uint8_t value;
+    esp_err_t result;
+} DRV2605_trace_record_t;
+
+#if DRV2605_TRACE_ENABLED
+#define DRV2605_TRACE(op, port, reg, value, result) haptic_trace_record((op), (port), (reg), (value), (result))
+#else
+#define DRV2605_TRACE(op, port, reg, value, result) do {} while(0)
+#endif
+
+// Appends a record to the ring buffer of the calling core. Never blocks and
+// can be called from any task or ISR. Old records are overwritten.
+void haptic_trace_record(uint8_t op, uint8_t port, uint8_t reg, uint8_t value, esp_err_t result);
+// Copies the records of one core, oldest first, into `records`.
+// Returns the number of records copied.
+size_t haptic_trace_snapshot(uint8_t core, DRV2605_trace_record_t* records, size_t max_records);
+// Drops all recorded records
+void haptic_trace_clear(void);
+// Decodes and prints all records in human readable form
+void haptic_trace_print(void);
+// Prints all records hex encoded for offline decoding with tools/drv2605_trace.py
+void haptic_trace_print_raw(void);
+// Returns the average number of CPU cycles spent in haptic_trace_record, without
+// the overhead of the measuring loop. The measurement writes into the live
+// trace, so it clears the trace of all cores. Snapshot it first if needed.
+uint32_t haptic_trace_measure_cost(uint32_t iterations);
+
+#endif
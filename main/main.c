@@ -20,6 +20,7 @@ void i2c_setup(){
     ESP_ERROR_CHECK(i2c_param_config(I2C_PORT, &conf));
 
     ESP_ERROR_CHECK(i2c_driver_install(I2C_PORT, conf.mode, 0, 0, 0));
+    ESP_ERROR_CHECK(haptic_configure_bus_recovery(I2C_PORT, conf.sda_io_num, conf.scl_io_num, conf.sda_pullup_en));
 }
 
 void app_main(void)
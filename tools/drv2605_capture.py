@@ -0,0 +1,287 @@
+#!/usr/bin/env python3
+"""Replays and compares DRV2605 bus captures.
+
+A capture is recorded on the device with haptic_capture_start/stop and either
+copied off as a binary file or printed with haptic_capture_print_raw() into the
+serial log. Both forms are accepted.
+
+  drv2605_capture.py replay CAPTURE     replay against the simulated DRV2605 and
+                                        report transaction and bus statistics
+  drv2605_capture.py diff BEFORE AFTER  compare the statistics and access
+                                        pattern of two captures
+"""
+import argparse
+import difflib
+import struct
+import sys
+from collections import Counter
+
+HEADER = struct.Struct("<IB3x")
+RECORD = struct.Struct("<IHBBBBh")
+MAGIC = 0x50433244
+VERSION = 1
+RAW_PREFIX = "DRVCAP:"
+
+FLAG_READ = 0x01
+FLAG_CHAINED = 0x02
+
+REG_MODE = 0x01
+REG_GO = 0x0C
+MASK_MODE_RESET = 0x80
+
+REGISTERS = {
+    0x00: "STATUS", 0x01: "MODE", 0x02: "RTPIN", 0x03: "LIBRARY",
+    0x04: "WAVESEQ1", 0x05: "WAVESEQ2", 0x06: "WAVESEQ3", 0x07: "WAVESEQ4",
+    0x08: "WAVESEQ5", 0x09: "WAVESEQ6", 0x0A: "WAVESEQ7", 0x0B: "WAVESEQ8",
+    0x0C: "GO", 0x0D: "OVERDRIVE", 0x0E: "SUSTAINPOS", 0x0F: "SUSTAINNEG",
+    0x10: "BREAK", 0x11: "AUDIOCTRL", 0x12: "AUDIOLVL", 0x13: "AUDIOMAX",
+    0x14: "AUDIOOUTMIN", 0x15: "AUDIOOUTMAX", 0x16: "RATEDV", 0x17: "CLAMPV",
+    0x18: "AUTOCALCOMP", 0x19: "AUTOCALEMP", 0x1A: "FEEDBACK", 0x1B: "CONTROL1",
+    0x1C: "CONTROL2", 0x1D: "CONTROL3", 0x1E: "CONTROL4", 0x1F: "CONTROL5",
+    0x20: "OPNLOOPPER", 0x21: "VBAT", 0x22: "LRARESON",
+}
+
+# Register content after power up or reset according to the data sheet
+RESET_VALUES = [
+    0x60, 0x40, 0x00, 0x01, 0x01, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x05, 0x19, 0xFF, 0x19, 0xFF, 0x3E, 0x8C,
+    0x0C, 0x6C, 0x36, 0x93, 0xF5, 0xA0, 0x20, 0x80,
+    0x33, 0x00, 0x00,
+]
+
+# Changed by the device itself, reads of these are not compared
+VOLATILE = {0x00, 0x0C, 0x18, 0x19, 0x21, 0x22}
+
+
+class Transaction:
+    __slots__ = ("timestamp", "duration", "port", "flags", "reg", "data", "result")
+
+    def __init__(self, timestamp, duration, port, flags, reg, data, result):
+        self.timestamp = timestamp
+        self.duration = duration
+        self.port = port
+        self.flags = flags
+        self.reg = reg
+        self.data = data
+        self.result = result
+
+    @property
+    def read(self):
+        return bool(self.flags & FLAG_READ)
+
+    @property
+    def chained(self):
+        return bool(self.flags & FLAG_CHAINED)
+
+    def describe(self):
+        return "{} {} {:<11} [{}]{}".format(
+            "R" if self.read else "W", self.port, REGISTERS.get(self.reg, "0x{:02x}".format(self.reg)),
+            " ".join("{:02x}".format(b) for b in self.data), "" if self.result == 0 else " ERR {}".format(self.result))
+
+
+class SimulatedDrv2605:
+    """Register level model of the DRV2605 with auto incrementing access."""
+
+    def __init__(self):
+        self.registers = list(RESET_VALUES)
+
+    def write(self, reg, data):
+        for offset, value in enumerate(data):
+            address = reg + offset
+            if address >= len(self.registers):
+                break
+            if address == REG_MODE and value & MASK_MODE_RESET:
+                # the reset restores all defaults and the bit clears itself
+                self.registers = list(RESET_VALUES)
+                continue
+            if address == REG_GO:
+                # playback is not modelled, GO is done immediately
+                value = 0
+            self.registers[address] = value
+
+    def read(self, reg, length):
+        return bytes(self.registers[reg + i] if reg + i < len(self.registers) else 0 for i in range(length))
+
+
+def load_bytes(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) >= HEADER.size and HEADER.unpack_from(data)[0] == MAGIC:
+        return data
+    # not a binary log, collect the hex lines from a serial log
+    raw = bytearray()
+    for line in data.decode("utf-8", "replace").splitlines():
+        start = line.find(RAW_PREFIX)
+        if start >= 0:
+            raw += bytes.fromhex(line[start + len(RAW_PREFIX):].strip())
+    return bytes(raw)
+
+
+def parse(path):
+    data = load_bytes(path)
+    if len(data) < HEADER.size:
+        sys.exit("{}: no capture found".format(path))
+    magic, version = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION:
+        sys.exit("{}: unsupported capture (magic 0x{:08x}, version {})".format(path, magic, version))
+    transactions = []
+    offset = HEADER.size
+    epoch = 0
+    previous = None
+    while offset + RECORD.size <= len(data):
+        timestamp, duration, port, flags, reg, length, result = RECORD.unpack_from(data, offset)
+        offset += RECORD.size
+        payload = data[offset:offset + length]
+        offset += length
+        # only the lower 32 bits of the timestamp are stored. Records are
+        # appended on completion but stamped with the start time, so a small
+        # step backwards is an overlapping transaction and not a wrap.
+        if previous is not None and previous - timestamp > 1 << 31:
+            epoch += 1 << 32
+        elif previous is not None and timestamp - previous > 1 << 31:
+            epoch -= 1 << 32
+        previous = timestamp
+        transactions.append(Transaction(epoch + timestamp, duration, port, flags, reg, payload, result))
+    transactions.sort(key=lambda transaction: transaction.timestamp)
+    return transactions
+
+
+def wire_time_us(transaction, bus_speed):
+    # 9 clocks per byte plus START and STOP, a read adds a repeated START and the read address
+    data_bytes = max(len(transaction.data), 1 if transaction.read else 0)
+    bytes_on_wire = 2 + data_bytes + (1 if transaction.read else 0)
+    clocks = bytes_on_wire * 9 + 2 + (1 if transaction.read else 0)
+    return clocks * 1e6 / bus_speed
+
+
+def percentile(values, fraction):
+    if not values:
+        return 0
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(fraction * len(ordered)))]
+
+
+def analyse(transactions, bus_speed):
+    stats = Counter()
+    stats["transactions"] = len(transactions)
+    stats["reads"] = sum(1 for t in transactions if t.read)
+    stats["writes"] = stats["transactions"] - stats["reads"]
+    stats["failed"] = sum(1 for t in transactions if t.result != 0)
+    stats["data bytes"] = sum(len(t.data) for t in transactions)
+    accesses = [t for t in transactions if not t.chained]
+    stats["bus accesses"] = len(accesses)
+    if not transactions:
+        return stats, []
+    span = max(t.timestamp + t.duration for t in transactions) - transactions[0].timestamp
+    busy = sum(t.duration for t in accesses)
+    wire = sum(wire_time_us(t, bus_speed) for t in transactions)
+    stats["span us"] = span
+    stats["busy us"] = busy
+    stats["wire us"] = round(wire)
+    stats["occupancy %"] = round(100.0 * busy / span, 1) if span else 0
+    stats["wire occupancy %"] = round(100.0 * wire / span, 1) if span else 0
+    gaps = [b.timestamp - (a.timestamp + a.duration) for a, b in zip(accesses, accesses[1:])]
+    gaps = [max(gap, 0) for gap in gaps]
+    stats["gap min us"] = min(gaps) if gaps else 0
+    stats["gap median us"] = percentile(gaps, 0.5)
+    stats["gap p95 us"] = percentile(gaps, 0.95)
+    stats["gap max us"] = max(gaps) if gaps else 0
+    return stats, gaps
+
+
+def replay(transactions):
+    """Feeds the capture to the simulated device. Returns the reads whose
+    captured data differs from what the model holds."""
+    devices = {}
+    mismatches = []
+    for index, t in enumerate(transactions):
+        device = devices.setdefault(t.port, SimulatedDrv2605())
+        if t.result != 0:
+            continue
+        if t.read:
+            expected = device.read(t.reg, len(t.data))
+            for offset, (seen, modelled) in enumerate(zip(t.data, expected)):
+                if t.reg + offset not in VOLATILE and seen != modelled:
+                    mismatches.append((index, t, t.reg + offset, seen, modelled))
+        else:
+            device.write(t.reg, t.data)
+    return mismatches
+
+
+def print_stats(stats):
+    for key, value in stats.items():
+        print("  {:<18} {}".format(key, value))
+
+
+def access_pattern(transactions):
+    return Counter(("R" if t.read else "W", REGISTERS.get(t.reg, "0x{:02x}".format(t.reg))) for t in transactions)
+
+
+def command_replay(args):
+    transactions = parse(args.capture)
+    stats, _ = analyse(transactions, args.bus_speed)
+    print("{}:".format(args.capture))
+    print_stats(stats)
+    mismatches = replay(transactions)
+    print("  {:<18} {}".format("model mismatches", len(mismatches)))
+    for index, t, reg, seen, modelled in mismatches[:args.limit]:
+        print("    #{} {}: device 0x{:02x}, model 0x{:02x} in {}".format(
+            index, t.describe(), seen, modelled, REGISTERS.get(reg, hex(reg))))
+    if args.verbose:
+        start = transactions[0].timestamp if transactions else 0
+        for t in transactions:
+            print("  {:>10} +{:>5} {}".format(t.timestamp - start, t.duration, t.describe()))
+
+
+def command_diff(args):
+    before = parse(args.before)
+    after = parse(args.after)
+    stats_before, _ = analyse(before, args.bus_speed)
+    stats_after, _ = analyse(after, args.bus_speed)
+    print("{:<20} {:>12} {:>12} {:>12}".format("", "before", "after", "delta"))
+    for key in list(stats_before) + [k for k in stats_after if k not in stats_before]:
+        a = stats_before.get(key, 0)
+        b = stats_after.get(key, 0)
+        print("{:<20} {:>12} {:>12} {:>+12}".format(key, a, b, round(b - a, 1)))
+
+    pattern_before = access_pattern(before)
+    pattern_after = access_pattern(after)
+    changed = sorted(k for k in pattern_before.keys() | pattern_after.keys() if pattern_before[k] != pattern_after[k])
+    if changed:
+        print("\nTransactions per register:")
+        for direction, reg in changed:
+            a = pattern_before[(direction, reg)]
+            b = pattern_after[(direction, reg)]
+            print("  {} {:<11} {:>8} {:>8} {:>+8}".format(direction, reg, a, b, b - a))
+
+    diff = list(difflib.unified_diff(
+        [t.describe() for t in before], [t.describe() for t in after],
+        args.before, args.after, n=2, lineterm=""))
+    if diff:
+        print("\nFirst differences in the access sequence:")
+        for line in diff[:args.limit]:
+            print("  " + line)
+        if len(diff) > args.limit:
+            print("  ... {} more lines".format(len(diff) - args.limit))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--bus-speed", type=float, default=400000, help="I2C clock in Hz used for wire time (default 400000)")
+    parser.add_argument("--limit", type=int, default=40, help="maximum number of detail lines")
+    commands = parser.add_subparsers(dest="command", required=True)
+    replay_parser = commands.add_parser("replay", help="replay a capture against the simulated device")
+    replay_parser.add_argument("capture")
+    replay_parser.add_argument("-v", "--verbose", action="store_true", help="list every transaction")
+    replay_parser.set_defaults(run=command_replay)
+    diff_parser = commands.add_parser("diff", help="compare two captures")
+    diff_parser.add_argument("before")
+    diff_parser.add_argument("after")
+    diff_parser.set_defaults(run=command_diff)
+    args = parser.parse_args()
+    args.run(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""Decodes DRV2605 driver trace records.
+
+Accepts either a serial log containing the lines printed by
+haptic_trace_print_raw() or a raw binary dump of DRV2605_trace_record_t
+records (use --binary).
+"""
+import argparse
+import struct
+import sys
+
+RECORD = struct.Struct("<IBBBBi")
+RAW_PREFIX = "DRVTRACE:"
+
+OPS = {0x01: "READ", 0x02: "WRITE", 0x03: "WRITE_SEQ", 0x04: "MODIFY", 0x05: "READ_SEQ"}
+
+REGISTERS = {
+    0x00: "STATUS", 0x01: "MODE", 0x02: "RTPIN", 0x03: "LIBRARY",
+    0x04: "WAVESEQ1", 0x05: "WAVESEQ2", 0x06: "WAVESEQ3", 0x07: "WAVESEQ4",
+    0x08: "WAVESEQ5", 0x09: "WAVESEQ6", 0x0A: "WAVESEQ7", 0x0B: "WAVESEQ8",
+    0x0C: "GO", 0x0D: "OVERDRIVE", 0x0E: "SUSTAINPOS", 0x0F: "SUSTAINNEG",
+    0x10: "BREAK", 0x11: "AUDIOCTRL", 0x12: "AUDIOLVL", 0x13: "AUDIOMAX",
+    0x14: "AUDIOOUTMIN", 0x15: "AUDIOOUTMAX", 0x16: "RATEDV", 0x17: "CLAMPV",
+    0x18: "AUTOCALCOMP", 0x19: "AUTOCALEMP", 0x1A: "FEEDBACK", 0x1B: "CONTROL1",
+    0x1C: "CONTROL2", 0x1D: "CONTROL3", 0x1E: "CONTROL4", 0x1F: "CONTROL5",
+    0x20: "OPNLOOPPER", 0x21: "VBAT", 0x22: "LRARESON",
+}
+
+
+def records_from_log(lines):
+    for line in lines:
+        start = line.find(RAW_PREFIX)
+        if start < 0:
+            continue
+        core, _, payload = line[start + len(RAW_PREFIX):].strip().partition(":")
+        data = bytes.fromhex(payload)
+        if len(data) != RECORD.size:
+            continue
+        yield (int(core),) + RECORD.unpack(data)
+
+
+def records_from_binary(data):
+    for offset in range(0, len(data) - RECORD.size + 1, RECORD.size):
+        yield (0,) + RECORD.unpack_from(data, offset)
+
+
+def op_name(op):
+    if op >= 0x80:
+        return "USER"
+    return OPS.get(op, "UNKNOWN")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("input", nargs="?", help="log or dump file, defaults to stdin")
+    parser.add_argument("--binary", action="store_true", help="input is a raw record dump")
+    args = parser.parse_args()
+
+    if args.binary:
+        with open(args.input, "rb") if args.input else sys.stdin.buffer as f:
+            records = list(records_from_binary(f.read()))
+    else:
+        with open(args.input) if args.input else sys.stdin as f:
+            records = list(records_from_log(f))
+
+    records.sort(key=lambda r: r[1])
+    previous = None
+    for core, timestamp, op, port, reg, value, result in records:
+        delta = 0 if previous is None else (timestamp - previous) & 0xFFFFFFFF
+        previous = timestamp
+        print("{:>10} us (+{:>6}) core {} port {} {:<9} {:<11} 0x{:02x} {}".format(
+            timestamp, delta, core, port, op_name(op), REGISTERS.get(reg, "0x{:02x}".format(reg)),
+            value, "OK" if result == 0 else "ERR 0x{:x}".format(result & 0xFFFFFFFF)))
+
+
+if __name__ == "__main__":
+    main()